@@ -0,0 +1,241 @@
+#include "components/event_dispatcher/async_dispatcher.h"
+#include "components/thread_pool/thread_pool.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+const uint64_t kNotQueued = ~uint64_t(0);
+
+// Events of one type handed to the batch slots through a Dispatcher.
+class EventBatch : public Event {
+public:
+    EventBatch(Descriptor descriptor, std::vector<AsyncDispatcher::EventPtr>&& events)
+      : descriptor_(descriptor),
+        events_(std::move(events)) {
+    }
+
+    virtual Descriptor Type() const {
+        return descriptor_;
+    }
+
+    const std::vector<AsyncDispatcher::EventPtr>& Events() const {
+        return events_;
+    }
+
+private:
+    Descriptor descriptor_;
+    std::vector<AsyncDispatcher::EventPtr> events_;
+};
+
+}
+
+AsyncDispatcher::AsyncDispatcher(size_t max_queue, size_t max_batch)
+  : max_queue_(max_queue),
+    max_batch_(max_batch > 0 ? max_batch : 1),
+    pool_(nullptr),
+    dispatcher_(Dispatcher::THREAD_SAFE),
+    batch_dispatcher_(Dispatcher::THREAD_SAFE),
+    dropped_(0) {
+    thread_ = std::thread([this] { Loop(); });
+}
+
+AsyncDispatcher::AsyncDispatcher(ThreadPool* pool, size_t max_queue, size_t max_batch)
+  : max_queue_(max_queue),
+    max_batch_(max_batch > 0 ? max_batch : 1),
+    pool_(pool),
+    dispatcher_(Dispatcher::THREAD_SAFE),
+    batch_dispatcher_(Dispatcher::THREAD_SAFE),
+    dropped_(0) {
+}
+
+AsyncDispatcher::~AsyncDispatcher() {
+    // Nothing is posted any more, so this also waits for the last batch
+    // to let go of the dispatcher.
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        delivered_cond_.wait(lock, [this] { return queue_.empty() && !busy_; });
+    }
+
+    if (pool_ == nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        thread_.join();
+    }
+}
+
+Subscriber AsyncDispatcher::Subscribe(const Event::Descriptor& descriptor, SlotType&& slot) {
+    return dispatcher_.Subscribe(descriptor, std::move(slot));
+}
+
+Subscriber AsyncDispatcher::Subscribe(const Event::Descriptor& descriptor,
+                                      const Dispatcher::Filter& filter, SlotType&& slot) {
+    return dispatcher_.Subscribe(descriptor, filter, std::move(slot));
+}
+
+Subscriber AsyncDispatcher::SubscribeBatch(const Event::Descriptor& descriptor,
+                                           BatchSlotType&& slot) {
+    if (!slot) {
+        return Subscriber();
+    }
+    BatchSlotType batch_slot(std::move(slot));
+    return batch_dispatcher_.Subscribe(descriptor, [batch_slot] (const Event& e) {
+        batch_slot(static_cast<const EventBatch&>(e).Events());
+    });
+}
+
+void AsyncDispatcher::UnSubscribe(const Subscriber& subscriber) {
+    // The handle knows which of the two dispatchers it belongs to.
+    Subscriber handle = subscriber;
+    handle.UnSubscribe();
+}
+
+void AsyncDispatcher::SetCoalescing(const Event::Descriptor& descriptor, bool coalesce) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (coalesce) {
+        coalesced_.insert(std::make_pair(descriptor, kNotQueued));
+    } else {
+        coalesced_.erase(descriptor);
+    }
+}
+
+bool AsyncDispatcher::Post(EventPtr event) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        uint64_t* last = nullptr;
+        if (!coalesced_.empty()) {
+            auto it = coalesced_.find(event->Type());
+            if (it != coalesced_.end()) {
+                last = &it->second;
+                if (*last != kNotQueued && *last >= head_seq_) {
+                    queue_[*last - head_seq_] = std::move(event);
+                    return true;
+                }
+            }
+        }
+
+        if (max_queue_ > 0 && queue_.size() >= max_queue_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (last != nullptr) {
+            *last = head_seq_ + queue_.size();
+        }
+        queue_.push_back(std::move(event));
+
+        if (pool_ != nullptr && !busy_) {
+            busy_ = true;
+            schedule = true;
+        }
+    }
+
+    if (pool_ == nullptr) {
+        cond_.notify_one();
+    } else if (schedule) {
+        Schedule();
+    }
+    return true;
+}
+
+void AsyncDispatcher::Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Coalescing replaces queued events in place, so the sequence number
+    // of the last event posted so far stays put.
+    uint64_t end = head_seq_ + queue_.size();
+    delivered_cond_.wait(lock, [this, end] { return delivered_seq_ >= end; });
+}
+
+uint64_t AsyncDispatcher::TakeBatch(std::vector<EventPtr>* events) {
+    size_t n = std::min(queue_.size(), max_batch_);
+    events->reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        events->push_back(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+    head_seq_ += n;
+    return head_seq_;
+}
+
+void AsyncDispatcher::Delivered(uint64_t seq) {
+    // Batches are delivered one at a time, in order.
+    delivered_seq_ = seq;
+    delivered_cond_.notify_all();
+}
+
+void AsyncDispatcher::Deliver(const std::vector<EventPtr>& events) {
+    for (auto&& event : events) {
+        dispatcher_.Post(*event);
+    }
+
+    // Group by type, keeping the order of first appearance.
+    std::vector<std::pair<Event::Descriptor, std::vector<EventPtr>>> groups;
+    std::unordered_map<Event::Descriptor, size_t> group_index;
+    for (auto&& event : events) {
+        auto result = group_index.insert(std::make_pair(event->Type(), groups.size()));
+        if (result.second) {
+            groups.emplace_back(event->Type(), std::vector<EventPtr>());
+        }
+        groups[result.first->second].second.push_back(event);
+    }
+    for (auto&& group : groups) {
+        batch_dispatcher_.Post(EventBatch(group.first, std::move(group.second)));
+    }
+}
+
+void AsyncDispatcher::Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+
+        std::vector<EventPtr> events;
+        uint64_t end = TakeBatch(&events);
+        busy_ = true;
+        lock.unlock();
+
+        Deliver(events);
+
+        lock.lock();
+        busy_ = false;
+        Delivered(end);
+    }
+}
+
+void AsyncDispatcher::Schedule() {
+    pool_->Enqueue([this] { RunOnPool(); });
+}
+
+void AsyncDispatcher::RunOnPool() {
+    std::vector<EventPtr> events;
+    uint64_t end;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        end = TakeBatch(&events);
+    }
+
+    Deliver(events);
+
+    // Give the pool's other tasks a turn before the next batch.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!queue_.empty()) {
+            Delivered(end);
+            Schedule();
+            return;
+        }
+        busy_ = false;
+        // Notify under the lock: the dispatcher may be destroyed as soon
+        // as the lock is released.
+        Delivered(end);
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef COMPONENTS_EVENT_DISPATHCER_ASYNC_DISPATCHER_H_
+#define COMPONENTS_EVENT_DISPATHCER_ASYNC_DISPATCHER_H_
+
+#include "components/event_dispatcher/dispatcher.h"
+#include "components/event_dispatcher/event.h"
+#include "components/event_dispatcher/subscriber.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+class ThreadPool;
+
+/*
+ * AsyncDispatcher queues posted events and calls the slots later, on a
+ * dedicated thread or on a ThreadPool, so that Post costs one short lock
+ * however slow the subscribers are.
+ *
+ * Events are taken off the queue up to "max_batch" at a time. Slots from
+ * Subscribe() are called once per event, in posting order. Slots from
+ * SubscribeBatch() are called once per event type present in the batch,
+ * with the events of that type in posting order.
+ *
+ * For an event type marked with SetCoalescing(), posting an event while
+ * another event of that type is still queued replaces the queued one, so
+ * subscribers only see the latest state.
+ *
+ * With "max_queue" > 0, Post drops events instead of waiting when that
+ * many events are queued.
+ *
+ * Slots run on one thread at a time. They must not call Flush() or
+ * destroy the AsyncDispatcher.
+ */
+class AsyncDispatcher {
+public:
+    using EventPtr = std::shared_ptr<const Event>;
+    using SlotType = Dispatcher::SlotType;
+    using BatchSlotType = std::function<void(const std::vector<EventPtr>& events)>;
+
+    // Delivers on a thread owned by the dispatcher.
+    explicit AsyncDispatcher(size_t max_queue = 0, size_t max_batch = 256);
+
+    // Delivers on "pool", which must outlive the dispatcher.
+    explicit AsyncDispatcher(ThreadPool* pool, size_t max_queue = 0, size_t max_batch = 256);
+
+    // Delivers the events still queued.
+    ~AsyncDispatcher();
+
+    AsyncDispatcher(const AsyncDispatcher&) = delete;
+    AsyncDispatcher& operator=(const AsyncDispatcher&) = delete;
+
+    // Like Dispatcher, these return an empty Subscriber for an empty slot.
+    Subscriber Subscribe(const Event::Descriptor& descriptor, SlotType&& slot);
+
+    Subscriber Subscribe(const Event::Descriptor& descriptor, const Dispatcher::Filter& filter,
+                         SlotType&& slot);
+
+    Subscriber SubscribeBatch(const Event::Descriptor& descriptor, BatchSlotType&& slot);
+
+    void UnSubscribe(const Subscriber& subscriber);
+
+    void SetCoalescing(const Event::Descriptor& descriptor, bool coalesce);
+
+    // Queues "event". Returns false if the queue is full.
+    bool Post(EventPtr event);
+
+    // Waits until every event posted before the call has been delivered.
+    // Events posted meanwhile do not delay it.
+    void Flush();
+
+    // Number of events dropped because the queue was full.
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    // Takes up to max_batch_ events off the queue and returns the sequence
+    // number following them. Called with mutex_ held.
+    uint64_t TakeBatch(std::vector<EventPtr>* events);
+
+    // Records that the events before "seq" have been delivered. Called with
+    // mutex_ held.
+    void Delivered(uint64_t seq);
+
+    void Deliver(const std::vector<EventPtr>& events);
+
+    void Loop();
+    void RunOnPool();
+    void Schedule();
+
+    const size_t max_queue_;
+    const size_t max_batch_;
+    ThreadPool* pool_;
+
+    Dispatcher dispatcher_;         // slots called per event
+    Dispatcher batch_dispatcher_;   // slots called per batch
+
+    std::mutex mutex_;
+    std::condition_variable cond_;      // events queued, or stop
+    std::condition_variable delivered_cond_; // a batch delivered
+    std::deque<EventPtr> queue_;
+    uint64_t head_seq_ = 0;             // sequence number of queue_.front()
+    uint64_t delivered_seq_ = 0;        // events before it are delivered
+    bool busy_ = false;                 // a batch is being delivered or scheduled
+    bool stop_ = false;
+
+    // Sequence number of the last queued event of each coalesced type; it
+    // is still queued if not below head_seq_.
+    std::map<Event::Descriptor, uint64_t> coalesced_;
+
+    std::atomic<uint64_t> dropped_;
+    std::thread thread_;
+
+}; // AsyncDispatcher
+
+#endif // COMPONENTS_EVENT_DISPATHCER_ASYNC_DISPATCHER_H_
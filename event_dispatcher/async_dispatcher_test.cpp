@@ -0,0 +1,197 @@
+#include "components/event_dispatcher/async_dispatcher.h"
+#include "components/event_dispatcher/event.h"
+#include "components/event_dispatcher/subscriber.h"
+#include "components/thread_pool/thread_pool.h"
+#include "thirdparty/glog/logging.h"
+#include "thirdparty/gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class ValueEvent : public Event {
+public:
+    explicit ValueEvent(int value)
+      : value_(value) {
+    }
+
+    static constexpr Descriptor descriptor = "ValueEvent";
+
+    virtual Descriptor Type() const {
+        return descriptor;
+    }
+
+    int Value() const { return value_; }
+
+private:
+    int value_;
+};
+constexpr ValueEvent::Descriptor ValueEvent::descriptor;
+
+class StateEvent : public ValueEvent {
+public:
+    explicit StateEvent(int value)
+      : ValueEvent(value) {
+    }
+
+    static constexpr Descriptor descriptor = "StateEvent";
+
+    virtual Descriptor Type() const {
+        return descriptor;
+    }
+};
+constexpr StateEvent::Descriptor StateEvent::descriptor;
+
+int ValueOf(const Event& e) {
+    return static_cast<const ValueEvent&>(e).Value();
+}
+
+}
+
+TEST(AsyncDispatcher, DeliversInOrder) {
+    AsyncDispatcher dispatcher;
+
+    std::vector<int> values;
+    dispatcher.Subscribe(ValueEvent::descriptor, [&values] (const Event& e) {
+        values.push_back(ValueOf(e));
+    });
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(dispatcher.Post(std::make_shared<ValueEvent>(i)));
+    }
+    dispatcher.Flush();
+
+    ASSERT_EQ(1000u, values.size());
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(i, values[i]);
+    }
+}
+
+TEST(AsyncDispatcher, SlowSubscriberDoesNotBlockPost) {
+    AsyncDispatcher dispatcher;
+
+    // The subscriber cannot finish before every event is posted.
+    std::mutex gate;
+    gate.lock();
+    std::atomic<int> handled(0);
+    dispatcher.Subscribe(ValueEvent::descriptor, [&] (const Event&) {
+        std::lock_guard<std::mutex> lock(gate);
+        handled.fetch_add(1);
+    });
+
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(dispatcher.Post(std::make_shared<ValueEvent>(i)));
+    }
+    EXPECT_EQ(0, handled.load());
+    gate.unlock();
+
+    dispatcher.Flush();
+    EXPECT_EQ(10, handled.load());
+}
+
+TEST(AsyncDispatcher, FlushUnderContinuousPosting) {
+    ThreadPool pool(2);
+    AsyncDispatcher dispatcher(&pool, 64);
+
+    std::atomic<int> handled(0);
+    dispatcher.Subscribe(ValueEvent::descriptor, [&handled] (const Event&) {
+        handled.fetch_add(1);
+    });
+
+    // The queue never stays empty while the poster runs; it is bounded so
+    // that the poster cannot outrun delivery without limit.
+    std::atomic<int> accepted(0);
+    std::atomic<bool> stop(false);
+    std::thread poster([&] {
+        for (int i = 0; !stop.load(); ++i) {
+            if (dispatcher.Post(std::make_shared<ValueEvent>(i))) {
+                accepted.fetch_add(1);
+            }
+        }
+    });
+    while (accepted.load() == 0) {
+        std::this_thread::yield();
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        int before = accepted.load();
+        dispatcher.Flush();
+        EXPECT_GE(handled.load(), before);
+    }
+
+    stop.store(true);
+    poster.join();
+}
+
+TEST(AsyncDispatcher, BatchesAndCoalescing) {
+    ThreadPool pool(2);
+    AsyncDispatcher dispatcher(&pool);
+    dispatcher.SetCoalescing(StateEvent::descriptor, true);
+
+    // Hold delivery back until everything is queued.
+    std::mutex gate;
+    gate.lock();
+    dispatcher.Subscribe(ValueEvent::descriptor, [&gate] (const Event&) {
+        std::lock_guard<std::mutex> lock(gate);
+    });
+
+    std::vector<std::vector<int>> batches;
+    dispatcher.SubscribeBatch(ValueEvent::descriptor,
+                              [&batches] (const std::vector<AsyncDispatcher::EventPtr>& events) {
+        batches.emplace_back();
+        for (auto&& e : events) {
+            batches.back().push_back(ValueOf(*e));
+        }
+    });
+    std::vector<int> states;
+    dispatcher.Subscribe(StateEvent::descriptor, [&states] (const Event& e) {
+        states.push_back(ValueOf(e));
+    });
+
+    dispatcher.Post(std::make_shared<ValueEvent>(0));
+    for (int i = 1; i <= 5; ++i) {
+        dispatcher.Post(std::make_shared<ValueEvent>(i));
+        dispatcher.Post(std::make_shared<StateEvent>(i));
+    }
+    gate.unlock();
+    dispatcher.Flush();
+
+    // The first event may or may not have been taken alone; the rest come
+    // as one batch.
+    std::vector<int> all;
+    for (auto&& batch : batches) {
+        all.insert(all.end(), batch.begin(), batch.end());
+    }
+    EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4, 5}), all);
+    EXPECT_LE(batches.size(), 2u);
+
+    ASSERT_EQ(1u, states.size());
+    EXPECT_EQ(5, states[0]);
+}
+
+TEST(AsyncDispatcher, BoundedQueue) {
+    AsyncDispatcher dispatcher(4);
+
+    std::mutex gate;
+    gate.lock();
+    std::atomic<int> handled(0);
+    dispatcher.Subscribe(ValueEvent::descriptor, [&] (const Event&) {
+        std::lock_guard<std::mutex> lock(gate);
+        handled.fetch_add(1);
+    });
+
+    int accepted = 0;
+    for (int i = 0; i < 100; ++i) {
+        accepted += dispatcher.Post(std::make_shared<ValueEvent>(i)) ? 1 : 0;
+    }
+    gate.unlock();
+    dispatcher.Flush();
+
+    EXPECT_LE(accepted, 4 + 4);     // a full queue plus a batch in flight
+    EXPECT_EQ(accepted, handled.load());
+    EXPECT_EQ(uint64_t(100 - accepted), dispatcher.Dropped());
+}
@@ -2,35 +2,344 @@
 #include "components/event_dispatcher/subscriber.h"
 
 #include <algorithm>
+#include <utility>
+
+namespace {
+
+const uint64_t kNoId = ~uint64_t(0);
+
+size_t HashDescriptor(Event::Descriptor descriptor) {
+    // Descriptors are addresses of string literals; the low bits carry
+    // little entropy, so mix the whole pointer (Fibonacci hashing).
+    uint64_t h = reinterpret_cast<uintptr_t>(descriptor) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(h >> 32);
+}
+
+// Number of THREAD_SAFE Post() calls the current thread is inside of. A
+// writer called from a slot must not wait for readers, as it is one.
+thread_local int post_depth = 0;
+
+class PostScope {
+public:
+    PostScope() { ++post_depth; }
+    ~PostScope() { --post_depth; }
+};
+
+}
+
+Dispatcher::Dispatcher(Mode mode)
+  : mode_(mode),
+    table_(new Table(8)) {
+}
+
+Dispatcher::~Dispatcher() {
+    Table* table = table_.load();
+    for (size_t i = 0; i <= table->mask; ++i) {
+        delete table->buckets[i].slots.load();
+    }
+    delete table;
+
+    for (Slots* slots : retired_slots_) {
+        delete slots;
+    }
+    for (Table* retired : retired_tables_) {
+        delete retired;
+    }
+}
+
+Dispatcher::Bucket* Dispatcher::FindBucket(Event::Descriptor descriptor) const {
+    Table* table = table_.load();
+    for (size_t i = HashDescriptor(descriptor) & table->mask; ; i = (i + 1) & table->mask) {
+        Bucket* bucket = &table->buckets[i];
+        Event::Descriptor d = bucket->descriptor.load();
+        if (d == descriptor) {
+            return bucket;
+        }
+        if (d == nullptr) {
+            return nullptr;
+        }
+    }
+}
+
+const Dispatcher::Slots* Dispatcher::FindSlots(Event::Descriptor descriptor) const {
+    Bucket* bucket = FindBucket(descriptor);
+    return bucket == nullptr ? nullptr : bucket->slots.load();
+}
+
+Dispatcher::Bucket* Dispatcher::FindOrAddBucket(Event::Descriptor descriptor) {
+    Bucket* bucket = FindBucket(descriptor);
+    if (bucket != nullptr) {
+        return bucket;
+    }
+
+    // Keep the load factor at or below 1/2 so that probes stay short and
+    // there is always an unused bucket to end a probe.
+    if ((used_buckets_ + 1) * 2 > table_.load()->mask + 1) {
+        Resize();
+    }
+
+    Table* table = table_.load();
+    size_t i = HashDescriptor(descriptor) & table->mask;
+    while (table->buckets[i].descriptor.load() != nullptr) {
+        i = (i + 1) & table->mask;
+    }
+    ++used_buckets_;
+    bucket = &table->buckets[i];
+    bucket->slots.store(new Slots);
+    bucket->descriptor.store(descriptor);
+    return bucket;
+}
+
+void Dispatcher::Resize() {
+    Table* old_table = table_.load();
+    Table* table = new Table((old_table->mask + 1) * 2);
+
+    for (size_t j = 0; j <= old_table->mask; ++j) {
+        Bucket& old = old_table->buckets[j];
+        Event::Descriptor descriptor = old.descriptor.load();
+        if (descriptor == nullptr) {
+            continue;
+        }
+        size_t i = HashDescriptor(descriptor) & table->mask;
+        while (table->buckets[i].descriptor.load() != nullptr) {
+            i = (i + 1) & table->mask;
+        }
+        // The slots are shared by both tables until the old one goes.
+        table->buckets[i].slots.store(old.slots.load());
+        table->buckets[i].descriptor.store(descriptor);
+    }
+
+    table_.store(table);
+    retired_tables_.push_back(old_table);
+}
+
+void Dispatcher::Publish(Bucket* bucket, Slots* slots) {
+    Slots* old_slots = bucket->slots.exchange(slots);
+    if (old_slots != slots) {
+        retired_slots_.push_back(old_slots);
+    }
+}
+
+void Dispatcher::Reclaim(std::unique_lock<std::mutex>* lock) {
+    // Retired data stays around until a writer is called outside Post.
+    if (mode_ == THREAD_SAFE && post_depth > 0) {
+        return;
+    }
+
+    std::vector<Slots*> retired_slots;
+    std::vector<Table*> retired_tables;
+    retired_slots.swap(retired_slots_);
+    retired_tables.swap(retired_tables_);
+
+    if (mode_ == THREAD_SAFE) {
+        // A slot running on another thread may be waiting for the lock
+        // while it holds up Synchronize(), so wait without the lock.
+        lock->unlock();
+        rcu_.Synchronize();
+    }
+
+    for (Slots* slots : retired_slots) {
+        delete slots;
+    }
+    for (Table* table : retired_tables) {
+        delete table;
+    }
+}
 
 Subscriber Dispatcher::Subscribe(const Event::Descriptor& descriptor, SlotType&& slot) {
-    SlotHandle handle = {next_id_++, slot};
-    subscribers_[descriptor].emplace_back(handle);
-    return Subscriber(this, handle.id);
+    return Subscribe(descriptor, Filter::None(), std::move(slot));
+}
+
+Subscriber Dispatcher::Subscribe(const Event::Descriptor& descriptor, const Filter& filter,
+                                 SlotType&& slot) {
+    if (!slot) {
+        return Subscriber();    // nothing to call, and Post must not try
+    }
+
+    std::unique_lock<std::mutex> lock(write_mutex_, std::defer_lock);
+    if (mode_ == THREAD_SAFE) {
+        lock.lock();
+    }
+
+    Bucket* bucket = FindOrAddBucket(descriptor);
+    Slots* slots = bucket->slots.load();
+    if (mode_ == THREAD_SAFE) {
+        slots = new Slots(*slots);
+    }
+
+    size_t position;
+    if (free_positions_.empty()) {
+        position = positions_.size();
+        positions_.emplace_back();
+    } else {
+        position = free_positions_.back();
+        free_positions_.pop_back();
+    }
+
+    uint64_t id = next_id_++;
+    SlotHandle handle = {id, position, std::move(slot)};
+
+    switch (filter.kind) {
+    case Filter::NONE:
+        positions_[position] = {id, slots->all.size(), filter};
+        slots->all.emplace_back(std::move(handle));
+        break;
+    case Filter::EQUAL: {
+        auto&& handles = slots->by_key[filter.low];
+        positions_[position] = {id, handles.size(), filter};
+        handles.emplace_back(std::move(handle));
+        break;
+    }
+    case Filter::RANGE: {
+        auto&& ranges = slots->ranges;
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), filter.low,
+                                   [] (Event::Key low, const RangeHandle& range) {
+                                       return low < range.low;
+                                   });
+        size_t index = it - ranges.begin();
+        RangeHandle range = {filter.low, filter.high, filter.high, std::move(handle)};
+        ranges.insert(it, std::move(range));
+        positions_[position] = {id, index, filter};
+        for (size_t i = index + 1; i < ranges.size(); ++i) {
+            positions_[ranges[i].handle.position].index = i;
+        }
+        UpdateMaxHigh(&ranges, 0, ranges.size());
+        break;
+    }
+    }
+
+    Publish(bucket, slots);
+    Reclaim(&lock);
+    return Subscriber(this, descriptor, id, position);
 }
 
 void Dispatcher::UnSubscribe(const Subscriber& subscriber) {
-    for (auto&& pair : subscribers_) {
-        auto&& handles = pair.second;
+    std::unique_lock<std::mutex> lock(write_mutex_, std::defer_lock);
+    if (mode_ == THREAD_SAFE) {
+        lock.lock();
+    }
+
+    if (subscriber.dispatcher_ != this || subscriber.descriptor_ == nullptr) {
+        return;     // an empty handle, or one of another dispatcher
+    }
+    size_t position = subscriber.position_;
+    if (position >= positions_.size() || positions_[position].id != subscriber.Id()) {
+        return;     // never subscribed here, or already unsubscribed
+    }
+
+    Bucket* bucket = FindBucket(subscriber.descriptor_);
+    if (bucket == nullptr || bucket->slots.load() == nullptr) {
+        return;
+    }
+    Slots* slots = bucket->slots.load();
+    if (mode_ == THREAD_SAFE) {
+        slots = new Slots(*slots);
+    }
 
-        handles.erase(std::remove_if(handles.begin(), handles.end(), 
-                                     [&] (SlotHandle& handle){
-                                        return handle.id == subscriber.Id();
-                                     }), 
-                      handles.end());
+    const Position& p = positions_[position];
+    switch (p.filter.kind) {
+    case Filter::NONE:
+        SwapRemove(&slots->all, p.index);
+        break;
+    case Filter::EQUAL: {
+        auto it = slots->by_key.find(p.filter.low);
+        SwapRemove(&it->second, p.index);
+        if (it->second.empty()) {
+            slots->by_key.erase(it);
+        }
+        break;
     }
+    case Filter::RANGE: {
+        auto&& ranges = slots->ranges;
+        ranges.erase(ranges.begin() + p.index);
+        for (size_t i = p.index; i < ranges.size(); ++i) {
+            positions_[ranges[i].handle.position].index = i;
+        }
+        if (!ranges.empty()) {
+            UpdateMaxHigh(&ranges, 0, ranges.size());
+        }
+        break;
+    }
+    }
+
+    positions_[position].id = kNoId;
+    free_positions_.push_back(position);
+    Publish(bucket, slots);
+    Reclaim(&lock);
+}
+
+void Dispatcher::SwapRemove(std::vector<SlotHandle>* handles, size_t index) {
+    // This changes the order in which the remaining slots are called.
+    if (index + 1 != handles->size()) {
+        (*handles)[index] = std::move(handles->back());
+        positions_[(*handles)[index].position].index = index;
+    }
+    handles->pop_back();
 }
 
 void Dispatcher::Post(const Event& event) const {
-    auto type = event.Type();
+    if (mode_ == THREAD_SAFE) {
+        PostScope scope;
+        Rcu::ReadLock lock(&rcu_);
+        Deliver(event);
+    } else {
+        Deliver(event);
+    }
+}
 
-    if (subscribers_.find(type) == subscribers_.end()) {
+void Dispatcher::Deliver(const Event& event) const {
+    const Slots* slots = FindSlots(event.Type());
+    if (slots == nullptr) {
         return;
     }
 
-    auto&& subscribers = subscribers_.at(type);
-
-    for (auto&& subscriber : subscribers) {
+    for (auto&& subscriber : slots->all) {
         subscriber.slot(event);
     }
+
+    Event::Key key;
+    if ((slots->by_key.empty() && slots->ranges.empty()) || !event.GetKey(&key)) {
+        return;
+    }
+
+    auto it = slots->by_key.find(key);
+    if (it != slots->by_key.end()) {
+        for (auto&& subscriber : it->second) {
+            subscriber.slot(event);
+        }
+    }
+
+    DeliverRanges(slots->ranges, 0, slots->ranges.size(), key, event);
+}
+
+void Dispatcher::DeliverRanges(const std::vector<RangeHandle>& ranges, size_t lo, size_t hi,
+                               Event::Key key, const Event& event) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const RangeHandle& range = ranges[mid];
+        if (range.max_high < key) {
+            return;     // no range below this node reaches "key"
+        }
+        DeliverRanges(ranges, lo, mid, key, event);
+        if (range.low > key) {
+            return;     // neither does any range to the right
+        }
+        if (range.high >= key) {
+            range.handle.slot(event);
+        }
+        lo = mid + 1;
+    }
+}
+
+Event::Key Dispatcher::UpdateMaxHigh(std::vector<RangeHandle>* ranges, size_t lo, size_t hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    RangeHandle& range = (*ranges)[mid];
+    range.max_high = range.high;
+    if (lo < mid) {
+        range.max_high = std::max(range.max_high, UpdateMaxHigh(ranges, lo, mid));
+    }
+    if (mid + 1 < hi) {
+        range.max_high = std::max(range.max_high, UpdateMaxHigh(ranges, mid + 1, hi));
+    }
+    return range.max_high;
 }
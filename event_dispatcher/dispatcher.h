@@ -2,33 +2,171 @@
 #define COMPONENTS_EVENT_DISPATHCER_DISPATCHER_H_
 
 #include "components/event_dispatcher/event.h"
+#include "components/event_dispatcher/slot.h"
+#include "components/util/rcu.h"
 
-#include <functional>
-#include <map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <stdint.h>
 
 class Subscriber;
 
+/*
+ * Dispatcher calls the slots subscribed to an event type when an event of
+ * that type is posted.
+ *
+ * A SINGLE_THREADED dispatcher must only be used by one thread at a time.
+ * A THREAD_SAFE dispatcher may be used from any number of threads: Post
+ * takes no lock and reads an immutable slot list, while Subscribe and
+ * UnSubscribe serialize on a mutex, publish a modified copy of the list
+ * and wait for readers of the old copy to finish before freeing it.
+ * Slots may subscribe and unsubscribe from within Post in that mode; such
+ * a change takes effect from the next Post.
+ */
 class Dispatcher {
 public:
-    using SlotType = std::function<void(const Event&)>;
+    // Slots are stored inline: a slot capturing more than kSlotCapacity
+    // bytes does not compile.
+    static const size_t kSlotCapacity = 32;
+    using SlotType = InlineSlot<kSlotCapacity>;
 
+    enum Mode { SINGLE_THREADED, THREAD_SAFE };
+
+    // Restricts a subscription to events whose key matches. Events without
+    // a key only reach subscriptions without a filter.
+    struct Filter {
+        enum Kind { NONE, EQUAL, RANGE };
+
+        Kind kind;
+        Event::Key low;     // the key for EQUAL
+        Event::Key high;    // inclusive
+
+        static Filter None() { return {NONE, 0, 0}; }
+        static Filter Equal(Event::Key key) { return {EQUAL, key, key}; }
+        static Filter Range(Event::Key low, Event::Key high) { return {RANGE, low, high}; }
+    };
+
+    explicit Dispatcher(Mode mode = SINGLE_THREADED);
+
+    ~Dispatcher();
+    Dispatcher(const Dispatcher&) = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+
+    // Returns an empty Subscriber, and subscribes nothing, if "slot" is
+    // empty.
     Subscriber Subscribe(const Event::Descriptor& descriptor, SlotType&& slot);
 
+    // Post only calls "slot" for events matching "filter". Filters are
+    // indexed per event type: EQUAL filters by key, RANGE filters in an
+    // interval tree, so a keyed Post skips the slots that do not match and
+    // finds the matching ranges in O((1 + matches) * log ranges).
+    // Subscribing or unsubscribing a RANGE filter costs O(range filters).
+    Subscriber Subscribe(const Event::Descriptor& descriptor, const Filter& filter,
+                         SlotType&& slot);
+
     void UnSubscribe(const Subscriber& subscriber);
 
     void Post(const Event& event) const;
 
 private:
-    uint64_t next_id_ = 0;
+    uint64_t next_id_ = 1;  // 0 is the id of an empty Subscriber
 
     struct SlotHandle {
         uint64_t id;
+        size_t position;    // index into positions_
         SlotType slot;
     };
 
-    std::map<Event::Descriptor, std::vector<SlotHandle>> subscribers_;
+    struct RangeHandle {
+        Event::Key low;
+        Event::Key high;
+        Event::Key max_high;    // highest "high" in the subtree rooted here
+        SlotHandle handle;
+    };
+
+    static_assert(std::is_nothrow_move_constructible<SlotHandle>::value &&
+                  std::is_nothrow_move_constructible<RangeHandle>::value,
+                  "slot lists would copy their slots when they grow");
+
+    // Slots of one event type.
+    struct Slots {
+        std::vector<SlotHandle> all;    // without filter
+        std::unordered_map<Event::Key, std::vector<SlotHandle>> by_key;
+        // Sorted by "low". Read as a balanced search tree whose root is
+        // the middle element, so "max_high" can prune the search.
+        std::vector<RangeHandle> ranges;
+    };
+
+    // Where each live subscription sits in its bucket, so that UnSubscribe
+    // is a swap with the last handle instead of a scan. Entries are reused
+    // through free_positions_; "id" tells a live entry from a stale handle.
+    struct Position {
+        uint64_t id;
+        size_t index;       // index into the list "filter" selects
+        Filter filter;
+    };
+
+    std::vector<Position> positions_;
+    std::vector<size_t> free_positions_;
+
+    // Subscribers are kept in an open addressing hash table keyed by the
+    // descriptor pointer, probed linearly. Buckets are never removed, since
+    // the set of event types a program uses is small and fixed.
+    struct Bucket {
+        Bucket() : descriptor(nullptr), slots(nullptr) {}
+
+        std::atomic<Event::Descriptor> descriptor;  // nullptr: unused bucket
+        std::atomic<Slots*> slots;
+    };
+
+    struct Table {
+        explicit Table(size_t size) : mask(size - 1), buckets(new Bucket[size]) {}
+
+        const size_t mask;  // size - 1, size is a power of two
+        std::unique_ptr<Bucket[]> buckets;
+    };
+
+    const Slots* FindSlots(Event::Descriptor descriptor) const;
+    Bucket* FindBucket(Event::Descriptor descriptor) const;
+    Bucket* FindOrAddBucket(Event::Descriptor descriptor);
+    void Resize();
+
+    // Called by Post() with readers protected as the mode requires.
+    void Deliver(const Event& event) const;
+
+    // Calls the slots of ranges[lo, hi) that contain "key", in order.
+    static void DeliverRanges(const std::vector<RangeHandle>& ranges, size_t lo, size_t hi,
+                              Event::Key key, const Event& event);
+
+    // Sets "max_high" in ranges[lo, hi) and returns the highest of them.
+    // Requires lo < hi.
+    static Event::Key UpdateMaxHigh(std::vector<RangeHandle>* ranges, size_t lo, size_t hi);
+
+    // Removes handles[index], moving the last handle into its place.
+    void SwapRemove(std::vector<SlotHandle>* handles, size_t index);
+
+    // Replaces the slots of "bucket" by "slots" and retires the old ones.
+    void Publish(Bucket* bucket, Slots* slots);
+
+    // Frees retired lists and tables: in place in SINGLE_THREADED mode, and
+    // once no reader can see them in THREAD_SAFE mode, after releasing
+    // "lock" on write_mutex_.
+    void Reclaim(std::unique_lock<std::mutex>* lock);
+
+    const Mode mode_;
+
+    size_t used_buckets_ = 0;
+    std::atomic<Table*> table_;
+
+    // Only used in THREAD_SAFE mode.
+    std::mutex write_mutex_;
+    mutable Rcu rcu_;
+    std::vector<Slots*> retired_slots_;
+    std::vector<Table*> retired_tables_;
 
 }; // Dispatcher
 
@@ -0,0 +1,174 @@
+#include "components/event_dispatcher/dispatcher.h"
+#include "components/event_dispatcher/event.h"
+#include "components/event_dispatcher/subscriber.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Measures Subscribe, Post and UnSubscribe across subscriber counts and
+ * numbers of event types, in both dispatcher modes. For each operation it
+ * reports throughput, cycles per operation (rdtsc; nanoseconds on other
+ * architectures) and heap allocations per operation.
+ *
+ *   dispatcher_bench [posts]
+ */
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+uint64_t Cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class BenchEvent : public Event {
+public:
+    explicit BenchEvent(Descriptor descriptor)
+      : descriptor_(descriptor) {
+    }
+
+    virtual Descriptor Type() const {
+        return descriptor_;
+    }
+
+private:
+    Descriptor descriptor_;
+};
+
+// Cost of one phase of a run.
+class Measure {
+public:
+    explicit Measure(uint64_t ops)
+      : ops_(ops),
+        allocations_(allocations.load(std::memory_order_relaxed)),
+        start_(std::chrono::steady_clock::now()),
+        cycles_(Cycles()) {
+    }
+
+    void Stop() {
+        cycles_ = Cycles() - cycles_;
+        elapsed_ = std::chrono::steady_clock::now() - start_;
+        allocations_ = allocations.load(std::memory_order_relaxed) - allocations_;
+    }
+
+    void Print(const char* mode, const char* op, size_t types, size_t subscribers) const {
+        printf("%-15s %-11s types=%-4zu subscribers=%-5zu ops/sec=%-11.0f cycles/op=%-9.1f allocs/op=%.3f\n",
+               mode, op, types, subscribers,
+               ops_ / elapsed_.count(),
+               static_cast<double>(cycles_) / ops_,
+               static_cast<double>(allocations_) / ops_);
+    }
+
+private:
+    uint64_t ops_;
+    uint64_t allocations_;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t cycles_;
+    std::chrono::duration<double> elapsed_;
+};
+
+void Run(Dispatcher::Mode mode, size_t types, size_t subscribers, uint64_t posts) {
+    static char names[256][24];
+    for (size_t i = 0; i < types; ++i) {
+        snprintf(names[i], sizeof(names[i]), "type%zu", i);
+    }
+    const char* mode_name = mode == Dispatcher::SINGLE_THREADED ? "single_threaded"
+                                                                : "thread_safe";
+
+    Dispatcher dispatcher(mode);
+    std::vector<Subscriber> handles;
+    handles.reserve(types * subscribers);
+
+    // Slots capture a little state, like real subscribers do.
+    uint64_t counters[4] = {0, 0, 0, 0};
+
+    Measure subscribe(types * subscribers);
+    for (size_t i = 0; i < subscribers; ++i) {
+        uint64_t* counter = &counters[i % 4];
+        uint64_t step = i + 1;
+        for (size_t t = 0; t < types; ++t) {
+            handles.push_back(dispatcher.Subscribe(names[t], [counter, step] (const Event&) {
+                *counter += step;
+            }));
+        }
+    }
+    subscribe.Stop();
+
+    std::vector<BenchEvent> events;
+    for (size_t t = 0; t < types; ++t) {
+        events.emplace_back(names[t]);
+    }
+
+    Measure post(posts);
+    for (uint64_t i = 0; i < posts; ++i) {
+        dispatcher.Post(events[i % types]);
+    }
+    post.Stop();
+
+    std::shuffle(handles.begin(), handles.end(), std::mt19937(301));
+    Measure unsubscribe(handles.size());
+    for (auto&& handle : handles) {
+        handle.UnSubscribe();
+    }
+    unsubscribe.Stop();
+
+    subscribe.Print(mode_name, "subscribe", types, subscribers);
+    post.Print(mode_name, "post", types, subscribers);
+    unsubscribe.Print(mode_name, "unsubscribe", types, subscribers);
+
+    // Keep the slots from being optimized away.
+    if (counters[0] + counters[1] + counters[2] + counters[3] == 0) {
+        fprintf(stderr, "no slot ran\n");
+    }
+}
+
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t posts = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    const size_t kTypeCounts[] = {1, 16, 256};
+    const size_t kSubscriberCounts[] = {1, 10, 100};
+    for (Dispatcher::Mode mode : {Dispatcher::SINGLE_THREADED, Dispatcher::THREAD_SAFE}) {
+        for (size_t types : kTypeCounts) {
+            for (size_t subscribers : kSubscriberCounts) {
+                Run(mode, types, subscribers, posts);
+            }
+        }
+    }
+    return 0;
+}
@@ -4,8 +4,16 @@
 #include "thirdparty/glog/logging.h"
 #include "thirdparty/gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 class DemoEvent : public Event {
 public:
@@ -98,3 +106,365 @@ TEST_F(DispatcherTest, Test) {
     s1.UnSubscribe();
     s2.UnSubscribe();
 }
+
+class NumberedEvent : public Event {
+public:
+    explicit NumberedEvent(Descriptor descriptor)
+      : descriptor_(descriptor) {
+    }
+
+    virtual Descriptor Type() const {
+        return descriptor_;
+    }
+
+private:
+    Descriptor descriptor_;
+};
+
+TEST(Dispatcher, ManyEventTypes) {
+    // Enough event types to make the subscriber table grow several times.
+    static const int kTypes = 100;
+    static char names[kTypes][16];
+
+    Dispatcher dispatcher;
+    int counts[kTypes] = {0};
+    std::vector<Subscriber> subscribers;
+    for (int i = 0; i < kTypes; ++i) {
+        snprintf(names[i], sizeof(names[i]), "type%d", i);
+        subscribers.push_back(dispatcher.Subscribe(names[i], [&counts, i] (const Event&) {
+            ++counts[i];
+        }));
+    }
+
+    for (int i = 0; i < kTypes; ++i) {
+        for (int j = 0; j <= i; ++j) {
+            dispatcher.Post(NumberedEvent(names[i]));
+        }
+    }
+    for (int i = 0; i < kTypes; ++i) {
+        EXPECT_EQ(i + 1, counts[i]);
+    }
+
+    // A descriptor with the same text but a different address is another type.
+    char other[8] = "type0";
+    dispatcher.Post(NumberedEvent(other));
+    EXPECT_EQ(1, counts[0]);
+
+    subscribers[0].UnSubscribe();
+    dispatcher.Post(NumberedEvent(names[0]));
+    dispatcher.Post(NumberedEvent(names[1]));
+    EXPECT_EQ(1, counts[0]);
+    EXPECT_EQ(3, counts[1]);
+}
+
+TEST(Dispatcher, UnSubscribeForeignHandles) {
+    for (Dispatcher::Mode mode : {Dispatcher::SINGLE_THREADED, Dispatcher::THREAD_SAFE}) {
+        Dispatcher dispatcher(mode);
+        Dispatcher other(mode);
+        int count = 0;
+        int other_count = 0;
+        dispatcher.Subscribe(DemoEvent::descriptor, [&count] (const Event&) { ++count; });
+        Subscriber foreign = other.Subscribe(DemoEvent::descriptor,
+                                             [&other_count] (const Event&) { ++other_count; });
+
+        // Neither an empty handle nor one of another dispatcher matches
+        // the first subscription.
+        dispatcher.UnSubscribe(Subscriber());
+        dispatcher.UnSubscribe(foreign);
+
+        dispatcher.Post(DemoEvent());
+        other.Post(DemoEvent());
+        EXPECT_EQ(1, count);
+        EXPECT_EQ(1, other_count);
+    }
+}
+
+TEST(Dispatcher, EmptySlot) {
+    Dispatcher::SlotType empty;
+    EXPECT_THROW(empty(DemoEvent()), std::bad_function_call);
+
+    void (*null_function)(const Event&) = nullptr;
+    EXPECT_FALSE(Dispatcher::SlotType(null_function));
+    EXPECT_FALSE(Dispatcher::SlotType(std::function<void(const Event&)>()));
+
+    for (Dispatcher::Mode mode : {Dispatcher::SINGLE_THREADED, Dispatcher::THREAD_SAFE}) {
+        Dispatcher dispatcher(mode);
+        Subscriber s = dispatcher.Subscribe(DemoEvent::descriptor, Dispatcher::SlotType());
+        EXPECT_EQ(0u, s.Id());
+        s = dispatcher.Subscribe(DemoEvent::descriptor, null_function);
+        EXPECT_EQ(0u, s.Id());
+
+        // Nothing was subscribed for Post to call.
+        dispatcher.Post(DemoEvent());
+    }
+}
+
+TEST(Dispatcher, UnSubscribeAnyOrder) {
+    static const int kSubscribers = 1000;
+
+    Dispatcher dispatcher;
+    std::vector<int> counts(kSubscribers, 0);
+    std::vector<Subscriber> subscribers;
+    for (int i = 0; i < kSubscribers; ++i) {
+        subscribers.push_back(dispatcher.Subscribe(DemoEvent::descriptor, [&counts, i] (const Event&) {
+            ++counts[i];
+        }));
+    }
+
+    // Drop every other subscriber, from the middle outwards.
+    for (int i = kSubscribers / 2; i < kSubscribers; i += 2) {
+        subscribers[i].UnSubscribe();
+        subscribers[kSubscribers - 1 - i].UnSubscribe();
+    }
+
+    // A stale handle must not remove the subscription that reuses its place.
+    Subscriber stale = subscribers[kSubscribers / 2];
+    auto reused = dispatcher.Subscribe(DemoEvent::descriptor, [&counts] (const Event&) {
+        ++counts[kSubscribers / 2];
+    });
+    stale.UnSubscribe();
+
+    dispatcher.Post(DemoEvent());
+    for (int i = 0; i < kSubscribers; ++i) {
+        bool removed = (i >= kSubscribers / 2) ? (i - kSubscribers / 2) % 2 == 0
+                                               : (kSubscribers - 1 - i - kSubscribers / 2) % 2 == 0;
+        if (i == kSubscribers / 2) {
+            EXPECT_EQ(1, counts[i]);    // the reused subscription
+        } else {
+            EXPECT_EQ(removed ? 0 : 1, counts[i]) << i;
+        }
+    }
+
+    reused.UnSubscribe();
+    for (auto&& subscriber : subscribers) {
+        subscriber.UnSubscribe();
+    }
+    dispatcher.Post(DemoEvent());
+    EXPECT_EQ(1, counts[kSubscribers / 2]);
+}
+
+TEST(Dispatcher, ConcurrentPost) {
+    static const int kPosters = 4;
+    static const int kPosts = 20000;
+
+    Dispatcher dispatcher(Dispatcher::THREAD_SAFE);
+    std::atomic<uint64_t> permanent(0);
+    dispatcher.Subscribe(DemoEvent::descriptor, [&permanent] (const Event&) {
+        permanent.fetch_add(1);
+    });
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+        // Churn subscriptions, and event types to make the table grow.
+        static char names[64][16];
+        int round = 0;
+        while (!stop.load()) {
+            auto s = dispatcher.Subscribe(DemoEvent::descriptor, [] (const Event&) {});
+            if (round < 64) {
+                snprintf(names[round], sizeof(names[round]), "type%d", round);
+                dispatcher.Subscribe(names[round], [] (const Event&) {});
+            }
+            s.UnSubscribe();
+            ++round;
+        }
+    });
+
+    std::vector<std::thread> posters;
+    for (int i = 0; i < kPosters; ++i) {
+        posters.emplace_back([&dispatcher] {
+            class QuietEvent : public Event {
+            public:
+                virtual Descriptor Type() const { return DemoEvent::descriptor; }
+            };
+            for (int j = 0; j < kPosts; ++j) {
+                dispatcher.Post(QuietEvent());
+            }
+        });
+    }
+    for (auto&& poster : posters) {
+        poster.join();
+    }
+    stop.store(true);
+    writer.join();
+
+    EXPECT_EQ(uint64_t(kPosters * kPosts), permanent.load());
+}
+
+TEST(Dispatcher, UnSubscribeFromSlot) {
+    Dispatcher dispatcher(Dispatcher::THREAD_SAFE);
+
+    int once_count = 0;
+    int other_count = 0;
+    Subscriber once;
+    once = dispatcher.Subscribe(DemoEvent::descriptor, [&] (const Event&) {
+        ++once_count;
+        once.UnSubscribe();
+    });
+    dispatcher.Subscribe(DemoEvent::descriptor, [&] (const Event&) {
+        ++other_count;
+    });
+
+    dispatcher.Post(DemoEvent());
+    dispatcher.Post(DemoEvent());
+    EXPECT_EQ(1, once_count);
+    EXPECT_EQ(2, other_count);
+}
+
+TEST(Dispatcher, SubscribeFromSlotWhileWriting) {
+    static const int kPosts = 2000;
+
+    Dispatcher dispatcher(Dispatcher::THREAD_SAFE);
+    std::atomic<int> slot_runs(0);
+    dispatcher.Subscribe(DemoEvent::descriptor, [&] (const Event&) {
+        // Let the writer take write_mutex_ and wait for this reader, then
+        // wait for write_mutex_ while still a reader.
+        std::this_thread::yield();
+        auto s = dispatcher.Subscribe("inner", [] (const Event&) {});
+        s.UnSubscribe();
+        slot_runs.fetch_add(1);
+    });
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+        // Waits for readers on every call.
+        while (!stop.load()) {
+            dispatcher.Subscribe("outer", [] (const Event&) {}).UnSubscribe();
+        }
+    });
+
+    class QuietEvent : public Event {
+    public:
+        virtual Descriptor Type() const { return DemoEvent::descriptor; }
+    };
+    for (int i = 0; i < kPosts; ++i) {
+        dispatcher.Post(QuietEvent());
+    }
+    stop.store(true);
+    writer.join();
+
+    EXPECT_EQ(kPosts, slot_runs.load());
+}
+
+TEST(Dispatcher, SlotReleasesCapture) {
+    Dispatcher dispatcher;
+
+    auto state = std::make_shared<int>(0);
+    auto s = dispatcher.Subscribe(DemoEvent::descriptor, [state] (const Event&) {
+        ++*state;
+    });
+    EXPECT_EQ(2, state.use_count());
+
+    dispatcher.Post(DemoEvent());
+    EXPECT_EQ(1, *state);
+
+    s.UnSubscribe();
+    EXPECT_EQ(1, state.use_count());
+}
+
+class KeyedEvent : public Event {
+public:
+    explicit KeyedEvent(Key key)
+      : key_(key) {
+    }
+
+    static constexpr Descriptor descriptor = "KeyedEvent";
+
+    virtual Descriptor Type() const {
+        return descriptor;
+    }
+
+    virtual bool GetKey(Key* key) const {
+        *key = key_;
+        return true;
+    }
+
+private:
+    Key key_;
+};
+constexpr KeyedEvent::Descriptor KeyedEvent::descriptor;
+
+class UnkeyedEvent : public Event {
+public:
+    virtual Descriptor Type() const {
+        return KeyedEvent::descriptor;
+    }
+};
+
+TEST(Dispatcher, FilteredSubscriptions) {
+    for (Dispatcher::Mode mode : {Dispatcher::SINGLE_THREADED, Dispatcher::THREAD_SAFE}) {
+        Dispatcher dispatcher(mode);
+
+        std::vector<std::string> calls;
+        auto record = [&calls] (const char* name) {
+            return [&calls, name] (const Event&) { calls.push_back(name); };
+        };
+
+        dispatcher.Subscribe(KeyedEvent::descriptor, record("all"));
+        auto eq5 = dispatcher.Subscribe(KeyedEvent::descriptor,
+                                        Dispatcher::Filter::Equal(5), record("eq5"));
+        dispatcher.Subscribe(KeyedEvent::descriptor, Dispatcher::Filter::Equal(7), record("eq7"));
+        auto r0_9 = dispatcher.Subscribe(KeyedEvent::descriptor,
+                                         Dispatcher::Filter::Range(0, 9), record("r0_9"));
+        dispatcher.Subscribe(KeyedEvent::descriptor, Dispatcher::Filter::Range(6, 6), record("r6_6"));
+        auto r3_5 = dispatcher.Subscribe(KeyedEvent::descriptor,
+                                         Dispatcher::Filter::Range(3, 5), record("r3_5"));
+
+        dispatcher.Post(KeyedEvent(5));
+        EXPECT_EQ((std::vector<std::string>{"all", "eq5", "r0_9", "r3_5"}), calls);
+
+        calls.clear();
+        dispatcher.Post(KeyedEvent(6));
+        EXPECT_EQ((std::vector<std::string>{"all", "r0_9", "r6_6"}), calls);
+
+        calls.clear();
+        dispatcher.Post(KeyedEvent(42));
+        dispatcher.Post(UnkeyedEvent());
+        EXPECT_EQ((std::vector<std::string>{"all", "all"}), calls);
+
+        r3_5.UnSubscribe();
+        eq5.UnSubscribe();
+        calls.clear();
+        dispatcher.Post(KeyedEvent(5));
+        dispatcher.Post(KeyedEvent(6));
+        EXPECT_EQ((std::vector<std::string>{"all", "r0_9", "all", "r0_9", "r6_6"}), calls);
+
+        r0_9.UnSubscribe();
+        calls.clear();
+        dispatcher.Post(KeyedEvent(6));
+        dispatcher.Post(KeyedEvent(7));
+        EXPECT_EQ((std::vector<std::string>{"all", "r6_6", "all", "eq7"}), calls);
+    }
+}
+
+TEST(Dispatcher, ManyRanges) {
+    static const int kRanges = 300;
+    static const int kKeys = 1000;
+
+    Dispatcher dispatcher;
+    std::mt19937 rng(301);
+    std::vector<std::pair<int, int>> bounds;
+    std::vector<Subscriber> subscribers;
+    std::vector<int> counts(kRanges, 0);
+    for (int i = 0; i < kRanges; ++i) {
+        int low = rng() % kKeys;
+        int high = low + rng() % (i % 10 == 0 ? kKeys : 20);
+        bounds.emplace_back(low, high);
+        int* count = &counts[i];
+        subscribers.push_back(dispatcher.Subscribe(KeyedEvent::descriptor,
+                                                   Dispatcher::Filter::Range(low, high),
+                                                   [count] (const Event&) { ++*count; }));
+    }
+    // Leave gaps in the tree.
+    for (int i = 0; i < kRanges; i += 3) {
+        subscribers[i].UnSubscribe();
+    }
+
+    for (int key = -1; key <= 2 * kKeys; ++key) {
+        std::fill(counts.begin(), counts.end(), 0);
+        dispatcher.Post(KeyedEvent(key));
+        for (int i = 0; i < kRanges; ++i) {
+            bool match = i % 3 != 0 && bounds[i].first <= key && key <= bounds[i].second;
+            ASSERT_EQ(match ? 1 : 0, counts[i]) << "key " << key << " range " << i;
+        }
+    }
+}
@@ -2,6 +2,7 @@
 #define COMPONENTS_EVENT_DISPATCHER_EVENT_H_
 
 #include <string>
+#include <stdint.h>
 
 class Event {
 public:
@@ -11,6 +12,12 @@ public:
 
     virtual Descriptor Type() const = 0;
 
+    using Key = int64_t;
+
+    // Events that carry a key, e.g. an account or a symbol id, return it
+    // here so that filtered subscriptions can be matched against it.
+    virtual bool GetKey(Key* key) const { return false; }
+
 }; // event
 
 #endif // COMPONENTS_EVENT_DISPATCHER_EVENT_H_
@@ -0,0 +1,150 @@
+#ifndef COMPONENTS_EVENT_DISPATHCER_SLOT_H_
+#define COMPONENTS_EVENT_DISPATHCER_SLOT_H_
+
+#include "components/event_dispatcher/event.h"
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * InlineSlot holds a callable taking "const Event&" in a buffer of
+ * "Capacity" bytes inside the object, so storing a slot never allocates.
+ * A callable that does not fit is rejected at compile time; capture a
+ * pointer to larger state instead.
+ *
+ * Callables must be copyable, since a THREAD_SAFE Dispatcher copies slot
+ * lists, and must not throw when moved, so that slot vectors move rather
+ * than copy their elements when they grow.
+ *
+ * Like std::function, a slot made from a null function pointer or an empty
+ * std::function is empty, and calling an empty slot throws
+ * std::bad_function_call.
+ */
+template<size_t Capacity>
+class InlineSlot {
+public:
+    InlineSlot() {}
+
+    template<class F,
+             class Callable = typename std::decay<F>::type,
+             class = typename std::enable_if<!std::is_same<Callable, InlineSlot>::value>::type>
+    InlineSlot(F&& f) {
+        static_assert(sizeof(Callable) <= Capacity,
+                      "slot captures too much state; capture a pointer instead");
+        static_assert(alignof(Callable) <= alignof(Storage),
+                      "slot requires stricter alignment than InlineSlot provides");
+        static_assert(std::is_nothrow_move_constructible<Callable>::value,
+                      "slot must not throw when moved");
+        if (IsNull(f)) {
+            return;
+        }
+        new (&storage_) Callable(std::forward<F>(f));
+        invoke_ = &Invoke<Callable>;
+        manage_ = &Manage<Callable>;
+    }
+
+    InlineSlot(const InlineSlot& other) {
+        if (other.manage_ != nullptr) {
+            other.manage_(COPY, &other.storage_, &storage_);
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+        }
+    }
+
+    InlineSlot(InlineSlot&& other) noexcept {
+        Take(&other);
+    }
+
+    ~InlineSlot() { Reset(); }
+
+    InlineSlot& operator=(const InlineSlot& other) {
+        if (this != &other) {
+            InlineSlot copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    InlineSlot& operator=(InlineSlot&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            Take(&other);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return invoke_ != nullptr; }
+
+    void operator()(const Event& event) const {
+        if (invoke_ == nullptr) {
+            throw std::bad_function_call();
+        }
+        invoke_(&storage_, event);
+    }
+
+private:
+    using Storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+
+    enum Operation { COPY, MOVE, DESTROY };
+
+    template<class F>
+    static bool IsNull(const F&) { return false; }
+
+    template<class R, class... Args>
+    static bool IsNull(R (*f)(Args...)) { return f == nullptr; }
+
+    template<class Signature>
+    static bool IsNull(const std::function<Signature>& f) { return !f; }
+
+    template<class Callable>
+    static void Invoke(const void* storage, const Event& event) {
+        (*static_cast<Callable*>(const_cast<void*>(storage)))(event);
+    }
+
+    // COPY and MOVE construct "to" from "from"; MOVE and DESTROY destroy
+    // "from" afterwards.
+    template<class Callable>
+    static void Manage(Operation op, const void* from, void* to) {
+        Callable* f = static_cast<Callable*>(const_cast<void*>(from));
+        switch (op) {
+        case COPY:
+            new (to) Callable(*f);
+            break;
+        case MOVE:
+            new (to) Callable(std::move(*f));
+            f->~Callable();
+            break;
+        case DESTROY:
+            f->~Callable();
+            break;
+        }
+    }
+
+    // Moves the callable of "other" here, leaving "other" empty.
+    void Take(InlineSlot* other) {
+        if (other->manage_ != nullptr) {
+            other->manage_(MOVE, &other->storage_, &storage_);
+            invoke_ = other->invoke_;
+            manage_ = other->manage_;
+            other->invoke_ = nullptr;
+            other->manage_ = nullptr;
+        }
+    }
+
+    void Reset() {
+        if (manage_ != nullptr) {
+            manage_(DESTROY, &storage_, nullptr);
+            invoke_ = nullptr;
+            manage_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    void (*invoke_)(const void*, const Event&) = nullptr;
+    void (*manage_)(Operation, const void*, void*) = nullptr;
+};
+
+#endif // COMPONENTS_EVENT_DISPATHCER_SLOT_H_
@@ -3,6 +3,7 @@
 
 #include "components/event_dispatcher/event.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 class Dispatcher;
@@ -16,13 +17,18 @@ public:
     void UnSubscribe();
 
 private:
-    Subscriber(Dispatcher* dispatcher, uint64_t id)
+    Subscriber(Dispatcher* dispatcher, Event::Descriptor descriptor,
+               uint64_t id, size_t position)
       : dispatcher_(dispatcher),
-        id_(id) {
+        descriptor_(descriptor),
+        id_(id),
+        position_(position) {
     }
 
     Dispatcher* dispatcher_ = nullptr;
+    Event::Descriptor descriptor_ = nullptr;
     uint64_t id_ = 0;
+    size_t position_ = 0;
 
     friend class Dispatcher;
 
@@ -1,127 +1,119 @@
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <memory>
 #include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "components/lru_cache/cache.h"
-#include "components/util/hash.h"
+#include "components/lru_cache/frequency_sketch.h"
+#include "components/lru_cache/lru_handle.h"
+#include "components/lru_cache/sharded_cache.h"
+#include "components/util/rcu.h"
 
 Cache::~Cache() {
 }
 
-namespace {
-// LRU cache implementation
-
-struct LRUHandle {
+Cache::Handle* Cache::GetOrLoad(const Slice& key, const Loader& loader,
+                                void (*deleter)(const Slice& key, void* value),
+                                Priority priority, uint32_t ttl_ms) {
+    Handle* handle = Lookup(key);
+    if (handle != nullptr) {
+        return handle;
+    }
     void* value;
-    void (*deleter)(const Slice&, void* value);
-    LRUHandle* next_hash;
-    LRUHandle* next;
-    LRUHandle* prev;
     size_t charge;
-    size_t key_length;
-    bool in_cache;      // Whether entry is in the cache.
-    uint32_t refs;      // References, including cache reference, if present.
-    uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
-    char key_data[1];   // Beginning of key
- 
-    Slice Key() const {
-        // next_ is only equal to this if the LRU handle is the list head of an
-        // empty list. List heads never have meaningful keys.
-        assert(next != this);
-
-        return Slice(key_data, key_length);
+    if (!loader(key, &value, &charge)) {
+        return nullptr;
     }
-};
+    return Insert(key, value, charge, deleter, priority, ttl_ms);
+}
+
+namespace {
+// LRU cache implementation
+//
+// Cache entries have an "in_cache" boolean indicating whether the cache
+// has a reference on the entry. The only ways that this can become false
+// without the entry being passed to its "deleter" are via Erase(), via
+// Insert() when an element with a duplicate key is inserted, or on
+// destruction of the cache.
+//
+// Every entry in the cache is on lru_, oldest first, whether or not
+// clients hold references to it; eviction skips the ones in use.
+//
+// lru_ is split in two pools: the low priority pool, from the oldest
+// entry up to lru_low_pri_, and the high priority pool after it. Entries
+// inserted with Priority::HIGH go to the high priority pool, others to
+// the low one, so eviction takes low priority entries first. When the
+// high priority pool outgrows its share of the capacity, its oldest
+// entries move to the low priority pool. Without a high priority pool,
+// lru_low_pri_ is the newest entry and lru_ is a plain LRU list.
+//
+// Lookup and Release take no lock. Lookup finds the entry under an Rcu
+// read lock and pins it with LRUHandle::TryRef(). Instead of moving the
+// entry to the front of lru_, which needs the mutex, it records the hit
+// in hits_, a small buffer indexed by hash where a newer hit may
+// overwrite an older one. Insert, Erase and Prune take the mutex and
+// first apply the recorded hits to lru_, so eviction sees (nearly) the
+// true recency order. An entry whose last reference is dropped has its
+// value deleted at once; its memory is freed once concurrent lookups
+// are done with it, in batches.
+//
+// Entries inserted with a time to live are also kept in expiry_. Lookup
+// treats an expired entry as missing; Insert and EvictExpired erase them.
+//
+// An entry's charge is the caller's, plus, if the shard charges metadata,
+// the memory of its header and key; the hash table's memory then counts
+// towards usage_ as well.
+//
+// With admission enabled (W-TinyLFU), the shard also counts how often
+// keys are inserted and hit in a FrequencySketch. New entries go to
+// window_, a small LRU list in front of lru_. An entry pushed out of the
+// window while the shard is full moves to lru_ only if it is seen more
+// often than the entry lru_ would evict first; otherwise it is dropped.
+// A scan of keys seen once therefore does not flush frequently used ones,
+// while the window gives newly popular keys the recency to build up
+// their counts. ClimbWindow() sizes the window between 1% and 80% of the
+// capacity by hill climbing on the hit ratio.
 
-class HandleTable {
+class LRUCache {
 public:
-    HandleTable() : length_(0), elems_(0), list_(nullptr) { Resize(); }
-    ~HandleTable() { delete[] list_; }
-
-    LRUHandle* Lookup(const Slice& key, uint32_t hash) {
-        return *FindPointer(key, hash);
-    }
-
-    LRUHandle* Insert(LRUHandle* h) {
-        LRUHandle** ptr = FindPointer(h->Key(), h->hash);
-        LRUHandle* old = *ptr;
-        h->next_hash = (old == nullptr ? nullptr : old->next_hash);
-        *ptr = h;
-        if (old == nullptr) {
-            ++elems_;
-            if (elems_ > length_) {
-                // Since each cache entry is fairly large, we aim for a small
-                // average linked list length (<= 1).
-                Resize();
-            }
-        }
-        return old;
-    }
+    explicit LRUCache(bool admission = false);
+    ~LRUCache();
 
-    LRUHandle* Remove(const Slice& key, uint32_t hash) {
-        LRUHandle** ptr = FindPointer(key, hash);
-        LRUHandle* result = *ptr;
-        if (result != nullptr) {
-            *ptr = result->next_hash;
-            --elems_;
-        }
-        return result;
+    // Leaves any eviction to Evict().
+    void SetCapacity(size_t capacity) {
+        std::lock_guard<ShardMutex> l(mutex_);
+        capacity_ = capacity;
+        high_pri_capacity_ = capacity_ * high_pri_pool_ratio_;
+        window_capacity_ = sketch_ != nullptr ? capacity_ * window_ratio_ : 0;
+        MaintainPoolSize();
     }
 
-private:
-    // The table consists of an array of buckets where each bucket is
-    // a linked list of cache entries that hash into the bucket.
-    uint32_t length_;
-    uint32_t elems_;
-    LRUHandle** list_;
-
-    LRUHandle** FindPointer(const Slice& key, uint32_t hash) {
-        LRUHandle** ptr = &list_[hash & (length_ - 1)];
-        while (*ptr != nullptr &&
-               ((*ptr)->hash != hash || key != (*ptr)->Key())) {
-            ptr = &(*ptr)->next_hash;
-        }
-        return ptr;
+    void SetHighPriorityPoolRatio(double ratio) {
+        high_pri_pool_ratio_ = ratio;
+        SetCapacity(capacity_);
     }
 
-    void Resize() {
-        uint32_t new_length = 4;
-        while (new_length < elems_) {
-            new_length *= 2;
-        }
-        LRUHandle** new_list = new LRUHandle*[new_length];
-        memset(new_list, 0, sizeof(new_list[0]) * new_length);
-        uint32_t count = 0;
-        for (uint32_t i = 0; i < length_; i++) {
-            LRUHandle* h = list_[i];
-            while (h != nullptr) {
-                LRUHandle* next = h->next_hash;
-                uint32_t hash = h->hash;
-                LRUHandle** ptr = &new_list[hash & (new_length - 1)];
-                h->next_hash = *ptr;
-                *ptr = h;
-                h = next;
-                count++;
-            }
+    // Whether entries' headers and keys and the hash table count against
+    // the capacity. Set before any Insert.
+    void SetChargeMetadata(bool charge_metadata) {
+        std::lock_guard<ShardMutex> l(mutex_);
+        assert(lru_size_ == 0);
+        if (charge_metadata && !charge_metadata_) {
+            usage_ += table_usage_;
+        } else if (!charge_metadata && charge_metadata_) {
+            usage_ -= table_usage_;
         }
-        assert(elems_ == count);
-        delete[] list_;
-        list_ = new_list;
-        length_ = new_length;
+        charge_metadata_ = charge_metadata;
     }
-};
-
-class LRUCache {
-public:
-    LRUCache();
-    ~LRUCache();
-
-    void SetCapacity(size_t capacity) { capacity_ = capacity; }
 
     Cache::Handle* Insert(const Slice& key, uint32_t hash,
                           void* value, size_t charge,
-                          void (*deleter)(const Slice& key, void* value));
+                          void (*deleter)(const Slice& key, void* value),
+                          Cache::Priority priority, uint64_t expire_time);
 
     Cache::Handle* Lookup(const Slice& key, uint32_t hash);
 
@@ -131,160 +123,498 @@ public:
 
     void Prune();
 
+    // Evicts up to "max_count" entries while usage is above "target".
+    // Adds their charge to *freed and returns how many it evicted.
+    size_t Evict(size_t target, size_t max_count, size_t* freed) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        ApplyHits();
+        size_t count = EvictLocked(target, max_count, freed);
+        FreeRetired(&l, kRetireBatch);
+        return count;
+    }
+
+    void EvictExpired() {
+        std::unique_lock<ShardMutex> l(mutex_);
+        RemoveExpired(NowMillis());
+        FreeRetired(&l, kRetireBatch);
+    }
+
     size_t TotalCharge() const {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::lock_guard<ShardMutex> lock(mutex_);
         return usage_;
     }
 
+    void AddStats(Cache::Stats* stats) const {
+        mutex_.AddStats(stats);
+        std::lock_guard<ShardMutex> l(mutex_);
+        stats->charge += usage_ - (charge_metadata_ ? entry_overhead_ + table_usage_ : 0);
+        stats->entry_overhead += entry_overhead_;
+        stats->table_overhead += table_usage_;
+    }
+
 private:
+    static const size_t kHitBufferSize = 64;    // power of two
+    static const size_t kRetireBatch = 64;
+
+    // Bounds of the share of the capacity for window_, with admission,
+    // and the share it starts at.
+    static constexpr double kMinWindowRatio = 0.01;
+    static constexpr double kMaxWindowRatio = 0.8;
+    // How far ClimbWindow() moves the share, at first and after a large
+    // change in the hit ratio; then the steps shrink by kStepDecay.
+    static constexpr double kWindowStep = 0.0625;
+    static constexpr double kStepDecay = 0.98;
+    static constexpr double kRestartThreshold = 0.05;
+    // Smaller changes of the hit ratio leave the window as it is; a scan
+    // that hits nothing must not walk it off to one side.
+    static constexpr double kMinChange = 0.005;
+    // Requests per entry of the shard in a hit ratio sample. Short
+    // samples are noisy but let the window follow phase changes.
+    static const size_t kSamplePeriod = 1;
+
+    // Bits of LRUHandle::queue.
+    static const uint8_t kHighPriority = 1;
+    static const uint8_t kInHighPriPool = 2;
+    static const uint8_t kInWindow = 4;
+
     void LRU_Remove(LRUHandle* e);
-    void LRU_Append(LRUHandle*list, LRUHandle* e);   
-    void Ref(LRUHandle* e);
-    void Unref(LRUHandle* e);
+    void LRU_Insert(LRUHandle* e);
+    void Window_Insert(LRUHandle* e);
+    void DrainWindow();
+    void ClimbWindow();
+    void MaintainPoolSize();
+    bool Unref(LRUHandle* e);
     bool FinishErase(LRUHandle* e);
+    void UpdateTableUsage();
+    size_t EvictLocked(size_t target, size_t max_count, size_t* freed);
+    void RemoveExpired(uint64_t now);
+    void ApplyHits();
+    void Retire(LRUHandle* e);
+    void FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count);
 
     size_t capacity_;
+    double high_pri_pool_ratio_;
+    size_t high_pri_capacity_;
+    bool charge_metadata_;
 
-    mutable std::mutex mutex_;
+    mutable ShardMutex mutex_;
+    // With charge_metadata_, usage_ includes entry_overhead_ and
+    // table_usage_, and entries' charge includes their own overhead.
     size_t usage_;
-
+    size_t entry_overhead_;
+    size_t table_usage_;
+    size_t lru_size_;
+    size_t high_pri_usage_;
+    size_t window_capacity_;
+    size_t window_usage_;
+    size_t window_size_;
+    // Hill climbing of the window's share: hits and misses of the current
+    // sample, the previous sample's hit ratio and the next step.
+    double window_ratio_;
+    size_t sample_hits_;
+    size_t sample_misses_;
+    double last_hit_ratio_;
+    double window_step_;
+
+    // Dummy head of LRU list.
+    // lru.prev is newest entry, lru.next is oldest entry.
     LRUHandle lru_;
-    LRUHandle in_use_;
+    // Newest entry of the low priority pool, or &lru_ if it is empty.
+    LRUHandle* lru_low_pri_;
+    // Dummy head of the admission window, laid out like lru_.
+    LRUHandle window_;
+    Rcu rcu_;
     HandleTable table_;
+    ExpiryQueue expiry_;
+
+    // Entries hit since the last ApplyHits().
+    std::atomic<LRUHandle*> hits_[kHitBufferSize];
+
+    // Access counts for admission, or nullptr to admit every entry.
+    std::unique_ptr<FrequencySketch> sketch_;
+
+    std::vector<LRUHandle*> retired_;
 };
 
-LRUCache::LRUCache() 
-  : usage_(0) {
-    // Make empty circular linked lists.
+LRUCache::LRUCache(bool admission) 
+  : capacity_(0),
+    high_pri_pool_ratio_(0),
+    high_pri_capacity_(0),
+    charge_metadata_(false),
+    usage_(0),
+    entry_overhead_(0),
+    table_usage_(0),
+    lru_size_(0),
+    high_pri_usage_(0),
+    window_capacity_(0),
+    window_usage_(0),
+    window_size_(0),
+    window_ratio_(kMinWindowRatio),
+    sample_hits_(0),
+    sample_misses_(0),
+    last_hit_ratio_(0),
+    window_step_(kWindowStep),
+    table_(&rcu_),
+    sketch_(admission ? new FrequencySketch : nullptr) {
+    table_usage_ = table_.MemoryUsage();
+    // Make empty circular linked list.
     lru_.next = &lru_;
     lru_.prev = &lru_; 
-    in_use_.next = &in_use_;
-    in_use_.prev = &in_use_;
+    lru_low_pri_ = &lru_;
+    window_.next = &window_;
+    window_.prev = &window_;
+    for (size_t i = 0; i < kHitBufferSize; i++) {
+        hits_[i].store(nullptr, std::memory_order_relaxed);
+    }
 }
 
 LRUCache::~LRUCache() {
-    assert(in_use_.next == &in_use_);
-    for (LRUHandle* e = lru_.next; e != &lru_; ) {
-        LRUHandle* next = e->next;
-        assert(e->in_cache);
-        e->in_cache = false;
-        assert(e->refs == 1);
-        Unref(e);
-        e = next;
+    for (LRUHandle* list : {&lru_, &window_}) {
+        for (LRUHandle* e = list->next; e != list; ) {
+            LRUHandle* next = e->next;
+            assert(e->in_cache);
+            e->in_cache = false;
+            assert(e->refs == 1);  // Error if caller has an unreleased handle
+            if (Unref(e)) {
+                free(e);
+            }
+            e = next;
+        }
     }
-}
-
-void LRUCache::Ref(LRUHandle* e) {
-    if (e->refs == 1 && e->in_cache) {
-        LRU_Remove(e);
-        LRU_Append(&in_use_, e);
+    for (LRUHandle* e : retired_) {
+        free(e);
     }
-    e->refs++;
 }
 
-void LRUCache::Unref(LRUHandle* e) {
+// Drops a reference to "e" and deletes its value if it was the last one.
+// Returns whether the caller must retire "e".
+bool LRUCache::Unref(LRUHandle* e) {
     assert(e->refs > 0);
-    e->refs--;
-    if (e->refs == 0) {  // Deallocate.
+    if (e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
         assert(!e->in_cache);
         (*e->deleter)(e->Key(), e->value);
-        free(e);
-    } else if (e->in_cache && e->refs == 1) { 
-        // No longer in use; move to lru_ list.
-        LRU_Remove(e);
-        LRU_Append(&lru_, e);
+        return true;
     }
+    return false;
 }
 
+// Takes "e" off lru_ or window_, whichever it is on.
 void LRUCache::LRU_Remove(LRUHandle* e) {
+    if (lru_low_pri_ == e) {
+        lru_low_pri_ = e->prev;
+    }
     e->next->prev = e->prev;
     e->prev->next = e->next;
+    if (e->queue & kInWindow) {
+        window_usage_ -= e->charge;
+        --window_size_;
+        return;
+    }
+    --lru_size_;
+    if (e->queue & kInHighPriPool) {
+        high_pri_usage_ -= e->charge;
+    }
 }
 
-void LRUCache::LRU_Append(LRUHandle* list, LRUHandle* e) {
-    // Make "e" newest entry by inserting just before *list
-    e->next = list;
-    e->prev = list->prev;
+// Makes "e" the newest entry of its pool.
+void LRUCache::LRU_Insert(LRUHandle* e) {
+    e->queue &= ~kInWindow;
+    LRUHandle* prev;
+    if (high_pri_capacity_ > 0 && (e->queue & kHighPriority)) {
+        prev = lru_.prev;
+        e->queue |= kInHighPriPool;
+        high_pri_usage_ += e->charge;
+    } else {
+        prev = lru_low_pri_;
+        e->queue &= ~kInHighPriPool;
+        lru_low_pri_ = e;
+    }
+    e->next = prev->next;
+    e->prev = prev;
     e->prev->next = e;
     e->next->prev = e;
+    ++lru_size_;
+    MaintainPoolSize();
+}
+
+// Makes "e" the newest entry of window_.
+void LRUCache::Window_Insert(LRUHandle* e) {
+    e->queue |= kInWindow;
+    e->next = &window_;
+    e->prev = window_.prev;
+    e->prev->next = e;
+    e->next->prev = e;
+    window_usage_ += e->charge;
+    ++window_size_;
+}
+
+// Moves the oldest entries of window_ to lru_ while the window is over its
+// capacity. If the shard is full, an entry only moves if it is seen more
+// often than lru_'s first victim, which EvictLocked() then removes; a
+// less frequent entry is erased instead. Called with mutex_ held.
+void LRUCache::DrainWindow() {
+    while (window_usage_ > window_capacity_) {
+        LRUHandle* candidate = window_.next;
+        LRUHandle* victim = nullptr;
+        if (usage_ > capacity_) {
+            for (LRUHandle* e = lru_.next; e != &lru_; e = e->next) {
+                if (e->refs.load(std::memory_order_relaxed) == 1) {
+                    victim = e;
+                    break;
+                }
+            }
+        }
+        if (victim != nullptr &&
+            sketch_->Frequency(candidate->hash) <= sketch_->Frequency(victim->hash)) {
+            FinishErase(table_.Remove(candidate->Key(), candidate->hash));
+        } else {
+            LRU_Remove(candidate);
+            LRU_Insert(candidate);
+        }
+    }
+}
+
+// Once per sample of requests, moves the window's share of the capacity
+// one step in the direction that last raised the hit ratio, or back if it
+// fell: recency-biased workloads get a large window, frequency-biased
+// ones a small one. Hits are those ApplyHits() sees, so repeated hits on
+// an entry between two calls count once; only the trend matters. Called
+// with mutex_ held.
+void LRUCache::ClimbWindow() {
+    size_t requests = sample_hits_ + sample_misses_;
+    if (requests < kSamplePeriod * (lru_size_ + window_size_)) {
+        return;
+    }
+    double hit_ratio = static_cast<double>(sample_hits_) / requests;
+    double change = hit_ratio - last_hit_ratio_;
+    last_hit_ratio_ = hit_ratio;
+    sample_hits_ = 0;
+    sample_misses_ = 0;
+    if (std::abs(change) < kMinChange) {
+        return;
+    }
+
+    double step = change >= 0 ? window_step_ : -window_step_;
+    if (std::abs(change) >= kRestartThreshold) {
+        window_step_ = step >= 0 ? kWindowStep : -kWindowStep;
+    } else {
+        window_step_ = step * kStepDecay;
+    }
+    window_ratio_ += step;
+    if (window_ratio_ < kMinWindowRatio) {
+        window_ratio_ = kMinWindowRatio;
+    } else if (window_ratio_ > kMaxWindowRatio) {
+        window_ratio_ = kMaxWindowRatio;
+    }
+    window_capacity_ = capacity_ * window_ratio_;
+}
+
+// Moves the oldest high priority entries to the low priority pool while
+// the high priority pool is over its capacity.
+void LRUCache::MaintainPoolSize() {
+    while (high_pri_usage_ > high_pri_capacity_) {
+        lru_low_pri_ = lru_low_pri_->next;
+        assert(lru_low_pri_ != &lru_);
+        lru_low_pri_->queue &= ~kInHighPriPool;
+        high_pri_usage_ -= lru_low_pri_->charge;
+    }
+}
+
+// Moves the entries hit since the last call to the front of lru_. Called
+// with mutex_ held. Entries in hits_ have not been freed yet, as
+// FreeRetired() applies the hits before freeing anything.
+void LRUCache::ApplyHits() {
+    for (size_t i = 0; i < kHitBufferSize; i++) {
+        if (hits_[i].load(std::memory_order_relaxed) == nullptr) {
+            continue;
+        }
+        LRUHandle* e = hits_[i].exchange(nullptr, std::memory_order_acquire);
+        if (e != nullptr && e->in_cache) {
+            bool in_window = e->queue & kInWindow;
+            LRU_Remove(e);
+            if (in_window) {
+                Window_Insert(e);
+            } else {
+                LRU_Insert(e);
+            }
+            if (sketch_ != nullptr) {
+                sketch_->Increment(e->hash);
+                sample_hits_++;
+            }
+        }
+    }
+}
+
+// Queues "e" to be freed once no Lookup can be looking at it. Called with
+// mutex_ held; FreeRetired() does the freeing.
+void LRUCache::Retire(LRUHandle* e) {
+    retired_.push_back(e);
+}
+
+// Frees the retired entries if there are at least "min_count". Called with
+// "lock" held on mutex_. Waits for the grace period with the lock released,
+// as that can take long, and may return with it released.
+void LRUCache::FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count) {
+    if (retired_.empty() || retired_.size() < min_count) {
+        return;
+    }
+    std::vector<LRUHandle*> retired;
+    retired.swap(retired_);
+    retired_.reserve(kRetireBatch);
+    lock->unlock();
+
+    rcu_.Synchronize();
+    lock->lock();
+    // After the grace period no Lookup can record these entries in hits_
+    // any more; drop those already recorded before freeing.
+    ApplyHits();
+    lock->unlock();
+    for (LRUHandle* e : retired) {
+        free(e);
+    }
 }
 
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
-    std::lock_guard<std::mutex> l(mutex_);
+    Rcu::ReadLock lock(&rcu_);
     LRUHandle* e = table_.Lookup(key, hash);
-    if (e != nullptr) {
-        Ref(e);
+    if (e == nullptr || e->Expired() || !e->TryRef()) {
+        return nullptr;
+    }
+    // Keep another entry's hit if the next slot is free, as admission
+    // counts on hits getting through.
+    size_t i = hash & (kHitBufferSize - 1);
+    LRUHandle* recorded = hits_[i].load(std::memory_order_relaxed);
+    if (recorded != nullptr && recorded != e) {
+        i = (i + 1) & (kHitBufferSize - 1);
+        recorded = hits_[i].load(std::memory_order_relaxed);
+    }
+    // Avoid dirtying the cache line when the hit is already recorded.
+    if (recorded != e) {
+        hits_[i].store(e, std::memory_order_release);
     }
     return reinterpret_cast<Cache::Handle*>(e);
 }
 
 void LRUCache::Release(Cache::Handle* handle) {
-    std::lock_guard<std::mutex> l(mutex_);
-    Unref(reinterpret_cast<LRUHandle*>(handle));
+    LRUHandle* e = reinterpret_cast<LRUHandle*>(handle);
+    if (Unref(e)) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        Retire(e);
+        FreeRetired(&l, kRetireBatch);
+    }
 }
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value)) {
+    void (*deleter)(const Slice& key, void* value), Cache::Priority priority,
+    uint64_t expire_time) {
 
-    std::lock_guard<std::mutex> l(mutex_);
+    std::unique_lock<ShardMutex> l(mutex_);
+    ApplyHits();
+    if (!expiry_.Empty()) {
+        RemoveExpired(NowMillis());
+    }
+    // Usage may be well above a capacity that was just lowered.
+    const size_t limit = std::max(capacity_, usage_);
 
-    LRUHandle* e = reinterpret_cast<LRUHandle*>(
-        malloc(sizeof(LRUHandle)-1 + key.Size()));
-    e->value = value;
-    e->deleter = deleter;
-    e->charge = charge;
-    e->key_length = key.Size();
-    e->hash = hash;
-    e->in_cache = false;
-    e->refs = 1;  // for the returned handle.
-    memcpy(e->key_data, key.Data(), key.Size());
+    LRUHandle* e = NewLRUHandle(key, hash, value, charge, deleter, expire_time);
+    if (priority == Cache::Priority::HIGH) {
+        e->queue = kHighPriority;
+    }
+    const size_t overhead = HandleMemory(e);
+    if (charge_metadata_) {
+        e->charge += overhead;
+    }
 
     if (capacity_ > 0) {
         e->refs++;  // for the cache's reference.
         e->in_cache = true;
-        LRU_Append(&in_use_, e);
-        usage_ += charge;
+        if (sketch_ != nullptr) {
+            sketch_->EnsureCapacity(lru_size_ + window_size_ + 1);
+            sketch_->Increment(hash);
+            Window_Insert(e);
+        } else {
+            LRU_Insert(e);
+        }
+        usage_ += e->charge;
+        entry_overhead_ += overhead;
         FinishErase(table_.Insert(e));
-    } else {  // don't cache. (capacity_==0 is supported and turns off caching.)
-        // next is read by key() in an assert, so it must be initialized
-        e->next = nullptr;
-    }
-    while (usage_ > capacity_ && lru_.next != &lru_) {
-        LRUHandle* old = lru_.next;
-        assert(old->refs == 1);
-        bool erased = FinishErase(table_.Remove(old->Key(), old->hash));
-        if (!erased) {  // to avoid unused variable when compiled NDEBUG
-            assert(erased);
+        UpdateTableUsage();
+        expiry_.Add(e);
+        if (sketch_ != nullptr) {
+            sample_misses_++;
+            ClimbWindow();
+            DrainWindow();
         }
-    }
+    }  // else don't cache. (capacity_==0 is supported and turns off caching.)
+
+    size_t freed = 0;
+    EvictLocked(limit, SIZE_MAX, &freed);
+    EvictLocked(capacity_, kEvictBatch, &freed);
+    FreeRetired(&l, kRetireBatch);
 
     return reinterpret_cast<Cache::Handle*>(e);
 }
 
+// Called with mutex_ held.
+size_t LRUCache::EvictLocked(size_t target, size_t max_count, size_t* freed) {
+    size_t count = 0;
+    // Evict from the oldest end, passing over entries in use; from the
+    // window only once lru_ has nothing left to give.
+    for (LRUHandle* list : {&lru_, &window_}) {
+        LRUHandle* old = list->next;
+        size_t steps = list == &lru_ ? lru_size_ : window_size_;
+        for (; usage_ > target && count < max_count && steps > 0; steps--) {
+            LRUHandle* next = old->next;
+            // Erasing "old" leaves the rest of the list in order, as
+            // retired entries are only freed, and hits applied, once the
+            // walk is over.
+            if (old != list && old->refs.load(std::memory_order_relaxed) == 1) {
+                *freed += old->charge;
+                bool erased = FinishErase(table_.Remove(old->Key(), old->hash));
+                if (!erased) {  // to avoid unused variable when compiled NDEBUG
+                    assert(erased);
+                }
+                count++;
+            }
+            old = next;
+        }
+    }
+    return count;
+}
+
 // If e != nullptr, finish removing *e from the cache; it has already been
 // removed from the hash table.  Return whether e != nullptr.
 bool LRUCache::FinishErase(LRUHandle* e) {
     if (e != nullptr) {
         assert(e->in_cache);
         LRU_Remove(e);
+        expiry_.Remove(e);
         e->in_cache = false;
         usage_ -= e->charge;
-        Unref(e);
+        entry_overhead_ -= HandleMemory(e);
+        if (Unref(e)) {
+            Retire(e);
+        }
     }
     return e != nullptr;
 }
 
-void LRUCache::Erase(const Slice& key, uint32_t hash) {
-    std::lock_guard<std::mutex> l(mutex_);
-    FinishErase(table_.Remove(key, hash));
+// Accounts for the hash table having grown. Called with mutex_ held.
+void LRUCache::UpdateTableUsage() {
+    if (charge_metadata_) {
+        usage_ -= table_usage_;
+    }
+    table_usage_ = table_.MemoryUsage();
+    if (charge_metadata_) {
+        usage_ += table_usage_;
+    }
 }
 
-void LRUCache::Prune() {
-    std::lock_guard<std::mutex> l(mutex_);
-    while (lru_.next != &lru_) {
-        LRUHandle* e = lru_.next;
-        assert(e->refs == 1);
+// Erases the entries expired at "now". Called with mutex_ held.
+void LRUCache::RemoveExpired(uint64_t now) {
+    LRUHandle* e;
+    while ((e = expiry_.Expired(now)) != nullptr) {
         bool erased = FinishErase(table_.Remove(e->Key(), e->hash));
         if (!erased) {  // to avoid unused variable when compiled NDEBUG
             assert(erased);
@@ -292,81 +622,60 @@ void LRUCache::Prune() {
     }
 }
 
-static const int kNumShardBits = 4;
-static const int kNumShards = 1 << kNumShardBits;
-
-class ShardedLRUCache : public Cache {
-private:
-    LRUCache shard_[kNumShards];
-    std::mutex id_mutex_;
-    uint64_t last_id_;
-
-    static inline uint32_t HashSlice(const Slice& s) {
-        return Hash(s.Data(), s.Size(), 0);
-    }
-
-    static uint32_t Shard(uint32_t hash) {
-        return hash >> (32 - kNumShardBits);
-    }
+void LRUCache::Erase(const Slice& key, uint32_t hash) {
+    std::unique_lock<ShardMutex> l(mutex_);
+    FinishErase(table_.Remove(key, hash));
+    FreeRetired(&l, kRetireBatch);
+}
 
-public:
-    explicit ShardedLRUCache(size_t capacity)
-      : last_id_(0) {
-        const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
-        for (int s = 0; s < kNumShards; s++) {
-            shard_[s].SetCapacity(per_shard);
+void LRUCache::Prune() {
+    std::unique_lock<ShardMutex> l(mutex_);
+    for (LRUHandle* list : {&lru_, &window_}) {
+        for (LRUHandle* e = list->next; e != list; ) {
+            LRUHandle* next = e->next;
+            if (e->refs.load(std::memory_order_relaxed) == 1) {
+                FinishErase(table_.Remove(e->Key(), e->hash));
+            }
+            e = next;
         }
     }
+    FreeRetired(&l, 1);
+}
 
-    virtual ~ShardedLRUCache() { }
-
-    virtual Handle* Insert(const Slice& key, void* value, size_t charge,
-                           void (*deleter)(const Slice& key, void* value)) {
-        const uint32_t hash = HashSlice(key);
-        return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter);
-    }
-
-    virtual Handle* Lookup(const Slice& key) {
-        const uint32_t hash = HashSlice(key);
-        return shard_[Shard(hash)].Lookup(key, hash);
-    }
-
-    virtual void Release(Handle* handle) {
-        LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
-        shard_[Shard(h->hash)].Release(handle);
-    }
+// LRUCache shard with admission, for ShardedCache to construct.
+class TinyLFUCache : public LRUCache {
+public:
+    TinyLFUCache() : LRUCache(true) { }
+};
 
-    virtual void Erase(const Slice& key) {
-        const uint32_t hash = HashSlice(key);
-        shard_[Shard(hash)].Erase(key, hash);
-    }
+} // end anonymous namespace
 
-    virtual void* Value(Handle* handle) {
-        return reinterpret_cast<LRUHandle*>(handle)->value;
-    }
+Cache* NewLRUCache(size_t capacity) {
+    return NewLRUCache(capacity, ShardedCache<LRUCache>::kDefaultShardBits);
+}
 
-    virtual uint64_t NewId() {
-        std::lock_guard<std::mutex> l(id_mutex_);
-        return ++(last_id_);
-    }
+Cache* NewLRUCache(size_t capacity, int num_shard_bits) {
+    return new ShardedCache<LRUCache>(capacity, num_shard_bits);
+}
 
-    virtual void Prune() {
-        for (int s = 0; s < kNumShards; s++) {
-            shard_[s].Prune();
-        }
-    }
+Cache* NewLRUCache(size_t capacity, int num_shard_bits, double high_pri_pool_ratio) {
+    return NewLRUCache(capacity, num_shard_bits, high_pri_pool_ratio, false);
+}
 
-    virtual size_t TotalCharge() const {
-        size_t total = 0;
-        for (int s = 0; s < kNumShards; s++) {
-            total += shard_[s].TotalCharge();
-        }
-        return total;
-    }
-};
+Cache* NewLRUCache(size_t capacity, int num_shard_bits, double high_pri_pool_ratio,
+                   bool charge_metadata) {
+    ShardedCache<LRUCache>* cache = new ShardedCache<LRUCache>(capacity, num_shard_bits);
+    cache->ForEachShard([high_pri_pool_ratio, charge_metadata] (LRUCache* shard) {
+        shard->SetHighPriorityPoolRatio(high_pri_pool_ratio);
+        shard->SetChargeMetadata(charge_metadata);
+    });
+    return cache;
+}
 
-} // end anonymous namespace
+Cache* NewTinyLFUCache(size_t capacity) {
+    return NewTinyLFUCache(capacity, ShardedCache<TinyLFUCache>::kDefaultShardBits);
+}
 
-Cache* NewLRUCache(size_t capacity) {
-    return new ShardedLRUCache(capacity);
+Cache* NewTinyLFUCache(size_t capacity, int num_shard_bits) {
+    return new ShardedCache<TinyLFUCache>(capacity, num_shard_bits);
 }
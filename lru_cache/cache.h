@@ -1,6 +1,7 @@
 #ifndef COMPONENTS_LRU_CACHE_H_
 #define COMPONENTS_LRU_CACHE_H_
 
+#include <functional>
 #include <stdint.h>
 
 #include "components/util/slice.h"
@@ -9,6 +10,54 @@ class Cache;
 
 Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache split into 2^num_shard_bits independently locked
+// shards. If num_shard_bits is negative, the count is picked from the
+// number of hardware threads, keeping each shard at least
+// kMinShardCapacity.
+Cache* NewLRUCache(size_t capacity, int num_shard_bits);
+
+// Create a new cache where entries inserted with Priority::HIGH are
+// evicted only after all others, as long as they take up no more than
+// high_pri_pool_ratio of the capacity. Beyond that, the least recently
+// used ones are treated like low priority entries.
+Cache* NewLRUCache(size_t capacity, int num_shard_bits, double high_pri_pool_ratio);
+
+// As above, but if "charge_metadata" is set, the memory the cache uses
+// for an entry's header and key and for its hash tables is counted
+// against the capacity too, so that small entries cannot make the cache
+// use much more memory than its capacity.
+Cache* NewLRUCache(size_t capacity, int num_shard_bits, double high_pri_pool_ratio,
+                   bool charge_metadata);
+
+// Create a cache that evicts with the CLOCK (second chance) policy. A hit
+// takes no lock and only sets the entry's reference bit, so lookups scale
+// with the number of reading threads.
+Cache* NewClockCache(size_t capacity);
+Cache* NewClockCache(size_t capacity, int num_shard_bits);
+
+// Create an LRU cache that admits a new entry only if its key is used
+// more often than the entry it would evict (W-TinyLFU), so that scans do
+// not flush the working set. New entries first wait in an LRU window,
+// which each shard resizes between 1% and 80% of its capacity to whatever
+// last raised its hit ratio; in shards too small for a window, a rejected
+// entry is returned uncached.
+//
+// It beats plain LRU where popularity is stable or keys are scanned or
+// looped over (on cache_bench at --capacity=10000: zipf 0.75 against
+// 0.72, scan 0.49 against 0.45, loop 0.70 against 0). Frequency counts
+// fade slower than recency and the window takes a few samples to grow, so
+// when the popular keys keep changing it still trails LRU (shifting 0.68
+// against 0.71, or 0.64 against 0.67 at --capacity=2000). Prefer
+// NewLRUCache() or NewClockCache() for workloads like that.
+Cache* NewTinyLFUCache(size_t capacity);
+Cache* NewTinyLFUCache(size_t capacity, int num_shard_bits);
+
+// Create a cache with the 2Q policy: new keys go to a small FIFO queue
+// and only keys that come back after leaving it are kept in the main
+// queue, so that both scans and keys used at long intervals are handled.
+Cache* NewTwoQueueCache(size_t capacity);
+Cache* NewTwoQueueCache(size_t capacity, int num_shard_bits);
+
 class Cache {
 public:
     Cache() = default;
@@ -20,13 +69,23 @@ public:
 
     struct Handle { };
 
+    // Caches created with a high priority pool evict HIGH entries last;
+    // others ignore the priority.
+    enum class Priority { HIGH, LOW };
+
     // Insert a mapping from key->value into the cache and assign it
     // the specified charge against the total cache capacity.
     // 
     // The caller must call this->Release(handle) when 
     // the returned mapping is no longer needed.
+    //
+    // A nonzero "ttl_ms" makes the mapping expire that many milliseconds
+    // from now: Lookup() stops returning it, and it is erased by the next
+    // Insert() into its shard, EvictExpired() or the expiry sweeper.
     virtual Handle* Insert(const Slice& key, void* value, size_t charge,
-                           void (*deleter)(const Slice& key, void* value)) = 0;
+                           void (*deleter)(const Slice& key, void* value),
+                           Priority priority = Priority::LOW,
+                           uint32_t ttl_ms = 0) = 0;
 
     // If the cache has no mapping for "key", returns nullptr.
     // Else return a handle that corresponds to the mapping.  
@@ -39,6 +98,19 @@ public:
     // successful Lookup().
     virtual void* Value(Handle* handle) = 0;
 
+    // Fills in the value of "key" and its charge, or returns false if it
+    // cannot be loaded. Must not throw.
+    using Loader = std::function<bool(const Slice& key, void** value, size_t* charge)>;
+
+    // Like Lookup(), but on a miss inserts the value "loader" loads and
+    // returns a handle on it, or nullptr if the load failed. Concurrent
+    // calls for the same missing key wait for one load instead of each
+    // running "loader".
+    virtual Handle* GetOrLoad(const Slice& key, const Loader& loader,
+                              void (*deleter)(const Slice& key, void* value),
+                              Priority priority = Priority::LOW,
+                              uint32_t ttl_ms = 0);
+
     // If the cache contains entry for key, erase it.
     virtual void Erase(const Slice& key) = 0;
 
@@ -48,10 +120,62 @@ public:
     // Remove all cache entries that are not actively in use.
     virtual void Prune() {}
 
+    // Erase the entries whose time to live has passed. Without Insert()
+    // calls they keep their charge until then; call this periodically,
+    // e.g. from a repeating ThreadTimer, or start the expiry sweeper to
+    // free it.
+    virtual void EvictExpired() {}
+
+    // Calls EvictExpired() every "interval_ms" from a thread of the
+    // cache's own, until StopExpirySweeper() or the cache is destroyed.
+    // Calling it again changes the interval from the next sweep on.
+    virtual void StartExpirySweeper(uint32_t interval_ms) {}
+
+    virtual void StopExpirySweeper() {}
+
     // Return an estimate of the combined charges of all elements stored in the
     // cache.
     virtual size_t TotalCharge() const = 0;
 
+    // Change the capacity. Entries beyond a smaller capacity are evicted
+    // a few at a time, so that concurrent calls are not held up for long.
+    virtual void SetCapacity(size_t capacity) = 0;
+    virtual size_t GetCapacity() const = 0;
+
+    // Evict entries that are not in use, in the order the cache would,
+    // until "charge" is freed or only entries in use are left; e.g. when
+    // the process nears its memory limit. The capacity stays the same.
+    // Returns the charge freed.
+    virtual size_t Shed(size_t charge) = 0;
+
+    // Smallest shard capacity an automatically sized cache is split into.
+    static const size_t kMinShardCapacity = 512 * 1024;
+
+    struct Stats {
+        size_t num_shards = 0;
+
+        // Times a shard's mutex was taken, and how many of those had to
+        // wait for another thread.
+        uint64_t lock_acquisitions = 0;
+        uint64_t lock_contentions = 0;
+
+        // GetOrLoad() calls that ran the loader, and that waited for
+        // another call's load of the same key instead.
+        uint64_t loads = 0;
+        uint64_t load_waits = 0;
+
+        // Memory of the cached entries: the charges given to Insert(),
+        // and what the cache adds for entry headers and keys and for its
+        // hash tables. Caches that charge metadata count all three
+        // against their capacity; TotalCharge() is then their sum.
+        size_t charge = 0;
+        size_t entry_overhead = 0;
+        size_t table_overhead = 0;
+    };
+
+    // Return counters that show how the cache is used.
+    virtual Stats GetStats() const { return Stats(); }
+
 private:
     void LRU_Remove(Handle* e);
     void LRU_Append(Handle* e);
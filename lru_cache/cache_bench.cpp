@@ -0,0 +1,223 @@
+#include "components/lru_cache/cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Replays key traces against each cache policy and reports hit ratio and
+ * throughput. On a miss the key is inserted with a charge of 1, so the
+ * capacity is a number of entries.
+ *
+ * A trace file holds one key per line. Without trace files, synthetic
+ * traces are replayed:
+ *
+ *   zipf      skewed popularity, where recency and frequency agree
+ *   scan      zipf, interrupted by scans of keys that are used once
+ *   loop      keys cycled in order, a little more than fit in the cache
+ *   shifting  zipf whose popular keys change every phase
+ *
+ *   cache_bench [--capacity=N] [--threads=N] [trace ...]
+ */
+
+namespace {
+
+typedef Cache* (*CacheFactory)(size_t capacity);
+
+struct Policy {
+    const char* name;
+    CacheFactory factory;
+};
+
+const Policy kPolicies[] = {
+    {"lru", &NewLRUCache},
+    {"clock", &NewClockCache},
+    {"tinylfu", &NewTinyLFUCache},
+    {"2q", &NewTwoQueueCache},
+};
+
+struct Trace {
+    std::string name;
+    std::vector<std::string> keys;
+};
+
+void NoopDeleter(const Slice& key, void* value) {
+}
+
+std::string Key(uint64_t k) {
+    return std::to_string(k);
+}
+
+// Draws keys 0..n-1 with probability proportional to 1/(k+1)^s.
+class Zipf {
+public:
+    Zipf(size_t n, double s, uint64_t seed) : rnd_(seed) {
+        cdf_.reserve(n);
+        double sum = 0;
+        for (size_t k = 0; k < n; k++) {
+            sum += 1.0 / std::pow(k + 1, s);
+            cdf_.push_back(sum);
+        }
+        for (double& c : cdf_) {
+            c /= sum;
+        }
+    }
+
+    uint64_t Next() {
+        double u = std::uniform_real_distribution<double>(0, 1)(rnd_);
+        return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    }
+
+private:
+    std::mt19937_64 rnd_;
+    std::vector<double> cdf_;
+};
+
+std::vector<Trace> SyntheticTraces(size_t capacity, size_t length) {
+    std::vector<Trace> traces;
+    const size_t universe = capacity * 10;
+
+    Trace zipf = {"zipf", {}};
+    Zipf z1(universe, 0.99, 1);
+    for (size_t i = 0; i < length; i++) {
+        zipf.keys.push_back(Key(z1.Next()));
+    }
+    traces.push_back(zipf);
+
+    Trace scan = {"scan", {}};
+    Zipf z2(universe, 0.99, 2);
+    uint64_t scan_key = universe;
+    while (scan.keys.size() < length) {
+        for (size_t i = 0; i < capacity * 4 && scan.keys.size() < length; i++) {
+            scan.keys.push_back(Key(z2.Next()));
+        }
+        for (size_t i = 0; i < capacity * 2 && scan.keys.size() < length; i++) {
+            scan.keys.push_back(Key(scan_key++));
+        }
+    }
+    traces.push_back(scan);
+
+    Trace loop = {"loop", {}};
+    const size_t period = capacity + capacity / 4;
+    for (size_t i = 0; i < length; i++) {
+        loop.keys.push_back(Key(i % period));
+    }
+    traces.push_back(loop);
+
+    Trace shifting = {"shifting", {}};
+    Zipf z3(universe, 0.99, 3);
+    const size_t phase = length / 8;
+    for (size_t i = 0; i < length; i++) {
+        uint64_t offset = (i / phase) * universe;
+        shifting.keys.push_back(Key(offset + z3.Next()));
+    }
+    traces.push_back(shifting);
+
+    return traces;
+}
+
+bool ReadTrace(const char* path, Trace* trace) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    trace->name = path;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) {
+            trace->keys.push_back(line);
+        }
+    }
+    return true;
+}
+
+// Returns the number of hits of one replay of "trace", started "start"
+// keys into it.
+uint64_t Replay(Cache* cache, const Trace& trace, size_t start) {
+    uint64_t hits = 0;
+    const size_t n = trace.keys.size();
+    for (size_t i = 0; i < n; i++) {
+        const std::string& key = trace.keys[(start + i) % n];
+        Cache::Handle* handle = cache->Lookup(key);
+        if (handle != nullptr) {
+            hits++;
+        } else {
+            handle = cache->Insert(key, nullptr, 1, &NoopDeleter);
+        }
+        cache->Release(handle);
+    }
+    return hits;
+}
+
+void Run(const Policy& policy, const Trace& trace, size_t capacity, int threads) {
+    Cache* cache = policy.factory(capacity);
+
+    std::vector<uint64_t> hits(threads, 0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            hits[t] = Replay(cache, trace, trace.keys.size() * t / threads);
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t total = 0;
+    for (uint64_t h : hits) {
+        total += h;
+    }
+    const double ops = static_cast<double>(trace.keys.size()) * threads;
+    Cache::Stats stats = cache->GetStats();
+    printf("%-8s %-16s capacity=%-8zu threads=%-3d hit_ratio=%-7.4f ops/sec=%-11.0f contention=%.4f\n",
+           policy.name, trace.name.c_str(), capacity, threads, total / ops,
+           ops / elapsed.count(),
+           stats.lock_acquisitions == 0 ? 0.0
+               : static_cast<double>(stats.lock_contentions) / stats.lock_acquisitions);
+
+    delete cache;
+}
+
+}
+
+int main(int argc, char** argv) {
+    size_t capacity = 10000;
+    int threads = 1;
+    std::vector<Trace> traces;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--capacity=", 11) == 0) {
+            capacity = strtoull(argv[i] + 11, nullptr, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = std::max(1, atoi(argv[i] + 10));
+        } else {
+            Trace trace;
+            if (!ReadTrace(argv[i], &trace)) {
+                fprintf(stderr, "cannot read trace %s\n", argv[i]);
+                return 1;
+            }
+            traces.push_back(trace);
+        }
+    }
+    if (traces.empty()) {
+        traces = SyntheticTraces(capacity, capacity * 100);
+    }
+
+    for (const Trace& trace : traces) {
+        for (const Policy& policy : kPolicies) {
+            Run(policy, trace, capacity, threads);
+        }
+    }
+    return 0;
+}
@@ -1,7 +1,11 @@
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "components/lru_cache/cache.h"
+#include "components/lru_cache/sharded_cache.h"
 #include "components/util/coding.h"
 
 #include "thirdparty/glog/logging.h"
@@ -21,7 +25,9 @@ static int DecodeKey(const Slice& k) {
 static void* EncodeValue(uintptr_t v) { return reinterpret_cast<void*>(v); }
 static int DecodeValue(void* v) { return reinterpret_cast<uintptr_t>(v); }
 
-class CacheTest : public testing::Test {
+typedef Cache* (*CacheFactory)(size_t capacity, int num_shard_bits);
+
+class CacheTest : public testing::TestWithParam<CacheFactory> {
 public:
     static CacheTest* current_;
 
@@ -37,7 +43,7 @@ public:
 
     Cache* cache_;
 
-    CacheTest() : cache_(NewLRUCache(kCacheSize)) {
+    CacheTest() : cache_(GetParam()(kCacheSize, 4)) {
         current_ = this;
     }
 
@@ -70,7 +76,7 @@ public:
 };
 CacheTest* CacheTest::current_;
 
-TEST_F(CacheTest, HitAndMiss) {
+TEST_P(CacheTest, HitAndMiss) {
     ASSERT_EQ(-1, Lookup(100));
 
     Insert(100, 101);
@@ -93,7 +99,7 @@ TEST_F(CacheTest, HitAndMiss) {
     ASSERT_EQ(101, deleted_values_[0]);
 }
 
-TEST_F(CacheTest, Erase) {
+TEST_P(CacheTest, Erase) {
     Erase(200);
     ASSERT_EQ(0, deleted_keys_.size());
 
@@ -114,7 +120,69 @@ TEST_F(CacheTest, Erase) {
     ASSERT_EQ(101, deleted_values_[0]);
 }
 
-TEST_F(CacheTest, EntriesArePinned) {
+TEST_P(CacheTest, EraseChurn) {
+    // Keys come and go, leaving deleted slots in the hash table behind.
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 20; i++) {
+            Insert(round * 100 + i, i);
+        }
+        for (int i = 0; i < 20; i += 2) {
+            Erase(round * 100 + i);
+        }
+        for (int i = 0; i < 20; i++) {
+            ASSERT_EQ(i % 2 == 0 ? -1 : i, Lookup(round * 100 + i));
+        }
+    }
+    for (int round = 0; round < 50; round++) {
+        for (int i = 1; i < 20; i += 2) {
+            Erase(round * 100 + i);
+        }
+    }
+    ASSERT_EQ(0, cache_->TotalCharge());
+    ASSERT_EQ(1000, deleted_keys_.size());
+}
+
+TEST_P(CacheTest, GetOrLoad) {
+    std::atomic<int> loads(0);
+    Cache::Loader loader = [&loads] (const Slice& key, void** value, size_t* charge) {
+        loads.fetch_add(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        *value = EncodeValue(DecodeKey(key) * 2);
+        *charge = 1;
+        return true;
+    };
+
+    // Concurrent misses on one key share a single load.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([this, &loader] {
+            Cache::Handle* h = cache_->GetOrLoad(EncodeKey(7), loader, &CacheTest::Deleter);
+            ASSERT_TRUE(h != nullptr);
+            EXPECT_EQ(14, DecodeValue(cache_->Value(h)));
+            cache_->Release(h);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(1, loads.load());
+    EXPECT_EQ(14, Lookup(7));
+    Cache::Stats stats = cache_->GetStats();
+    EXPECT_EQ(1, stats.loads);
+    EXPECT_LE(stats.load_waits, 7);
+
+    // A failed load caches nothing.
+    Cache::Loader failing = [&loads] (const Slice& key, void** value, size_t* charge) {
+        loads.fetch_add(1);
+        return false;
+    };
+    EXPECT_TRUE(cache_->GetOrLoad(EncodeKey(8), failing, &CacheTest::Deleter) == nullptr);
+    EXPECT_TRUE(cache_->GetOrLoad(EncodeKey(8), failing, &CacheTest::Deleter) == nullptr);
+    EXPECT_EQ(3, loads.load());
+    EXPECT_EQ(-1, Lookup(8));
+}
+
+TEST_P(CacheTest, EntriesArePinned) {
     Insert(100, 101);
     Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
     ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
@@ -139,7 +207,55 @@ TEST_F(CacheTest, EntriesArePinned) {
     ASSERT_EQ(102, deleted_values_[1]);
 }
 
-TEST_F(CacheTest, EvictionPolicy) {
+TEST_P(CacheTest, Expiry) {
+    const uint32_t kTTL = 20;
+    cache_->Release(cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                   &CacheTest::Deleter, Cache::Priority::LOW, kTTL));
+    Cache::Handle* h = cache_->Insert(EncodeKey(200), EncodeValue(201), 1,
+                                      &CacheTest::Deleter, Cache::Priority::LOW, kTTL);
+    Insert(300, 301);
+    ASSERT_EQ(101, Lookup(100));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * kTTL));
+    ASSERT_EQ(-1, Lookup(100));
+    ASSERT_EQ(-1, Lookup(200));
+    ASSERT_EQ(301, Lookup(300));
+
+    // Expired entries give back their charge, pinned or not.
+    cache_->EvictExpired();
+    ASSERT_EQ(1, cache_->TotalCharge());
+    ASSERT_EQ(1, deleted_keys_.size());
+    ASSERT_EQ(100, deleted_keys_[0]);
+
+    ASSERT_EQ(201, DecodeValue(cache_->Value(h)));
+    cache_->Release(h);
+    ASSERT_EQ(2, deleted_keys_.size());
+    ASSERT_EQ(200, deleted_keys_[1]);
+}
+
+TEST_P(CacheTest, ExpirySweeper) {
+    const uint32_t kTTL = 20;
+    cache_->Release(cache_->Insert(EncodeKey(100), EncodeValue(101), 1,
+                                   &CacheTest::Deleter, Cache::Priority::LOW, kTTL));
+    Insert(300, 301);
+    ASSERT_EQ(2, cache_->TotalCharge());
+
+    // The charge comes back with no Insert() or EvictExpired() call.
+    cache_->StartExpirySweeper(5);
+    for (int i = 0; i < 1000 && cache_->TotalCharge() > 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(1, cache_->TotalCharge());
+    ASSERT_EQ(1, deleted_keys_.size());
+    ASSERT_EQ(100, deleted_keys_[0]);
+    cache_->StopExpirySweeper();
+
+    // Restarted, the sweeper is stopped by the cache's destructor.
+    cache_->StartExpirySweeper(5);
+    ASSERT_EQ(301, Lookup(300));
+}
+
+TEST_P(CacheTest, EvictionPolicy) {
     // Overfill the cache, keeping handles on all inserted entries.
     std::vector<Cache::Handle*> h;
     for (int i = 0; i < kCacheSize + 100; i++) {
@@ -157,3 +273,359 @@ TEST_F(CacheTest, EvictionPolicy) {
     }
 }
 
+class RecencyTest : public CacheTest {
+};
+
+TEST_P(RecencyTest, HitsDelayEviction) {
+    for (int i = 0; i < kCacheSize / 2; i++) {
+        Insert(i, i);
+    }
+    // The oldest entries are hit, so the other old ones go first.
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(i, Lookup(i));
+    }
+    for (int i = kCacheSize; i < kCacheSize + 800; i++) {
+        Insert(i, i);
+    }
+    int evicted = 0;
+    for (int i = 10; i < kCacheSize / 2; i++) {
+        evicted += Lookup(i) == -1;
+    }
+    EXPECT_GT(evicted, 100);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(i, Lookup(i));
+    }
+}
+
+TEST_P(CacheTest, ConcurrentUse) {
+    static std::atomic<int> deleted;
+    deleted.store(0);
+    struct Counting {
+        static void Deleter(const Slice& key, void* v) {
+            deleted.fetch_add(1);
+        }
+    };
+
+    const int kThreads = 8;
+    const int kOps = 20000;
+    std::atomic<int> inserted(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([this, t, &inserted, kOps] {
+            for (int i = 0; i < kOps; i++) {
+                int key = (i * 7919 + t * 104729) % 2000;
+                Cache::Handle* h = cache_->Lookup(EncodeKey(key));
+                if (h != nullptr) {
+                    EXPECT_EQ(key * 2, DecodeValue(cache_->Value(h)));
+                    cache_->Release(h);
+                } else {
+                    inserted.fetch_add(1);
+                    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(key * 2), 1,
+                                                   &Counting::Deleter));
+                }
+                if (i % 97 == 0) {
+                    cache_->Erase(EncodeKey(key + 1));
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Cache::Stats stats = cache_->GetStats();
+    EXPECT_EQ(16, stats.num_shards);
+    EXPECT_GE(stats.lock_acquisitions, inserted.load());
+    EXPECT_LE(stats.lock_contentions, stats.lock_acquisitions);
+
+    delete cache_;
+    cache_ = nullptr;
+    EXPECT_EQ(inserted.load(), deleted.load());
+}
+
+TEST_P(CacheTest, ShardCount) {
+    CacheFactory factory = GetParam();
+
+    // A single shard holds exactly its capacity, however keys hash.
+    delete cache_;
+    cache_ = factory(kCacheSize, 0);
+    ASSERT_EQ(1, cache_->GetStats().num_shards);
+    for (int i = 0; i < kCacheSize; i++) {
+        Insert(i, i);
+    }
+    ASSERT_EQ(0, deleted_keys_.size());
+    Insert(kCacheSize, kCacheSize);
+    ASSERT_EQ(1, deleted_keys_.size());
+
+    // Small caches are not split; large ones get a power of two of shards.
+    delete cache_;
+    cache_ = factory(kCacheSize, -1);
+    ASSERT_EQ(1, cache_->GetStats().num_shards);
+    delete cache_;
+    cache_ = factory(1 << 30, -1);
+    size_t shards = cache_->GetStats().num_shards;
+    ASSERT_GE(shards, 1);
+    ASSERT_EQ(0, shards & (shards - 1));
+}
+
+TEST_P(CacheTest, SetCapacity) {
+    const size_t kSmall = kCacheSize / 10;
+    delete cache_;
+    cache_ = GetParam()(kCacheSize, 0);
+    for (int i = 0; i < kCacheSize; i++) {
+        Insert(i, i);
+    }
+    Cache::Handle* h = cache_->Lookup(EncodeKey(0));
+
+    // Shrinking evicts down to the new capacity, sparing entries in use.
+    cache_->SetCapacity(kSmall);
+    ASSERT_EQ(kSmall, cache_->GetCapacity());
+    ASSERT_EQ(kSmall, cache_->TotalCharge());
+    ASSERT_EQ(kCacheSize - kSmall, deleted_keys_.size());
+    ASSERT_EQ(0, DecodeValue(cache_->Value(h)));
+    ASSERT_EQ(0, Lookup(0));
+    cache_->Release(h);
+
+    cache_->SetCapacity(kCacheSize);
+    for (int i = 0; i < kCacheSize; i++) {
+        Insert(kCacheSize + i, i);
+    }
+    ASSERT_EQ(kSmall * 10, cache_->TotalCharge());
+}
+
+TEST_P(CacheTest, InsertLeavesShrinkingToSetCapacity) {
+    const size_t kSize = kCacheSize;
+    const size_t kSmall = kSize / 10;
+    const size_t kBatch = kEvictBatch;
+    delete cache_;
+    cache_ = GetParam()(kCacheSize, 0);
+    std::vector<Cache::Handle*> handles;
+    for (int i = 0; i < kCacheSize; i++) {
+        handles.push_back(InsertAndReturnHandle(i, i));
+    }
+
+    // Nothing can be evicted while every entry is in use.
+    cache_->SetCapacity(kSmall);
+    ASSERT_EQ(kSize, cache_->TotalCharge());
+    for (Cache::Handle* h : handles) {
+        cache_->Release(h);
+    }
+
+    // An Insert makes room for its entry and evicts about one batch more.
+    Insert(kCacheSize, kCacheSize);
+    ASSERT_LE(cache_->TotalCharge(), kSize - kBatch);
+    ASSERT_GE(cache_->TotalCharge(), kSize - 2 * kBatch);
+
+    cache_->SetCapacity(kSmall);
+    ASSERT_EQ(kSmall, cache_->TotalCharge());
+}
+
+TEST_P(CacheTest, Shed) {
+    for (int i = 0; i < 100; i++) {
+        Insert(i, i);
+    }
+    ASSERT_EQ(100, cache_->TotalCharge());
+    Cache::Handle* h = cache_->Lookup(EncodeKey(0));
+
+    // Each shard gives up its share, rounded up.
+    size_t freed = cache_->Shed(40);
+    ASSERT_GE(freed, 40);
+    ASSERT_LE(freed, 40 + cache_->GetStats().num_shards);
+    ASSERT_EQ(freed, deleted_keys_.size());
+    ASSERT_EQ(100 - freed, cache_->TotalCharge());
+
+    ASSERT_EQ(99 - freed, cache_->Shed(kCacheSize));
+    ASSERT_EQ(1, cache_->TotalCharge());
+    cache_->Release(h);
+}
+
+TEST_P(CacheTest, UsageBreakdown) {
+    for (int i = 0; i < 100; i++) {
+        Insert(i, i, 2);
+    }
+    Cache::Stats stats = cache_->GetStats();
+    ASSERT_EQ(200, stats.charge);
+    ASSERT_GE(stats.entry_overhead, 100 * (sizeof(void*) + 4));
+    ASSERT_GE(stats.table_overhead, 100 * sizeof(void*));
+
+    for (int i = 0; i < 100; i++) {
+        Erase(i);
+    }
+    stats = cache_->GetStats();
+    ASSERT_EQ(0, stats.charge);
+    ASSERT_EQ(0, stats.entry_overhead);
+}
+
+static Cache* NewLRUCacheWithHighPriorityPool(size_t capacity, int num_shard_bits) {
+    return NewLRUCache(capacity, 0, 0.5);
+}
+
+class PriorityTest : public CacheTest {
+public:
+    void InsertHigh(int key, int value) {
+        cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), 1,
+                                       &CacheTest::Deleter, Cache::Priority::HIGH));
+    }
+};
+
+TEST_P(PriorityTest, HighPriorityEvictedLast) {
+    // 800 high priority entries; 300 do not fit in the high priority pool.
+    for (int i = 0; i < 800; i++) {
+        InsertHigh(i, i);
+    }
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(i, Lookup(i));
+    }
+
+    // The overflow goes first, then the older low priority entries.
+    for (int i = 1000; i < 2000; i++) {
+        Insert(i, i);
+    }
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(i, Lookup(i));
+    }
+    int high = 0;
+    for (int i = 0; i < 800; i++) {
+        high += Lookup(i) == i;
+    }
+    EXPECT_EQ(kCacheSize / 2, high);
+    for (int i = 1500; i < 2000; i++) {
+        EXPECT_EQ(i, Lookup(i));
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(LRU, PriorityTest,
+                        testing::Values(&NewLRUCacheWithHighPriorityPool));
+
+static Cache* NewLRUCacheChargingMetadata(size_t capacity, int num_shard_bits) {
+    return NewLRUCache(capacity, num_shard_bits, 0, true);
+}
+
+class MetadataChargeTest : public CacheTest { };
+
+TEST_P(MetadataChargeTest, OverheadCountsAgainstCapacity) {
+    const size_t kCapacity = 64 * 1024;
+    delete cache_;
+    cache_ = GetParam()(kCapacity, 0);
+    for (int i = 0; i < 10000; i++) {
+        Insert(i, i);
+    }
+
+    // Entries take far more memory than their charge of 1.
+    Cache::Stats stats = cache_->GetStats();
+    ASSERT_LE(cache_->TotalCharge(), kCapacity);
+    ASSERT_EQ(cache_->TotalCharge(),
+              stats.charge + stats.entry_overhead + stats.table_overhead);
+    ASSERT_LT(stats.charge * 16, kCapacity);
+    ASSERT_EQ(10000 - stats.charge, deleted_keys_.size());
+}
+
+INSTANTIATE_TEST_CASE_P(LRU, MetadataChargeTest,
+                        testing::Values(&NewLRUCacheChargingMetadata));
+
+INSTANTIATE_TEST_CASE_P(Policies, CacheTest,
+                        testing::Values(static_cast<CacheFactory>(&NewLRUCache),
+                                        static_cast<CacheFactory>(&NewClockCache),
+                                        static_cast<CacheFactory>(&NewTinyLFUCache),
+                                        static_cast<CacheFactory>(&NewTwoQueueCache)));
+
+// Admission keeps old entries in place of new ones seen as often.
+INSTANTIATE_TEST_CASE_P(Policies, RecencyTest,
+                        testing::Values(static_cast<CacheFactory>(&NewLRUCache),
+                                        static_cast<CacheFactory>(&NewClockCache)));
+
+class ClockCacheTest : public CacheTest {
+};
+
+TEST_P(ClockCacheTest, SecondChance) {
+    // Cold entries first, then hot ones that are hit once.
+    for (int i = 0; i < 900; i++) {
+        Insert(i, i);
+    }
+    for (int i = 900; i < 1000; i++) {
+        Insert(i, i);
+    }
+    for (int i = 900; i < 1000; i++) {
+        ASSERT_EQ(i, Lookup(i));
+    }
+
+    // Make room for new entries; the hand passes over the hot ones.
+    for (int i = 1000; i < 1400; i++) {
+        Insert(i, i);
+    }
+
+    int cold_hits = 0;
+    for (int i = 0; i < 900; i++) {
+        cold_hits += Lookup(i) != -1;
+    }
+    for (int i = 900; i < 1000; i++) {
+        EXPECT_EQ(i, Lookup(i));
+    }
+    EXPECT_LT(cold_hits, 600);
+}
+
+INSTANTIATE_TEST_CASE_P(Clock, ClockCacheTest,
+                        testing::Values(static_cast<CacheFactory>(&NewClockCache)));
+
+class TinyLFUCacheTest : public CacheTest {
+};
+
+TEST_P(TinyLFUCacheTest, ScanResistance) {
+    const int kHot = 100;
+    for (int i = 0; i < kHot; i++) {
+        Insert(i, i);
+    }
+    // Hits are counted when a later write to the shard applies them.
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < kHot; i++) {
+            ASSERT_EQ(i, Lookup(i));
+        }
+        for (int i = 0; i < 100; i++) {
+            Insert(10000 + round * 100 + i, i);
+        }
+    }
+
+    // A scan of keys used once, ten times the capacity.
+    for (int i = 100000; i < 100000 + 10 * kCacheSize; i++) {
+        Insert(i, i);
+    }
+
+    int hot_hits = 0;
+    for (int i = 0; i < kHot; i++) {
+        hot_hits += Lookup(i) == i;
+    }
+    EXPECT_GE(hot_hits, 90);
+}
+
+INSTANTIATE_TEST_CASE_P(TinyLFU, TinyLFUCacheTest,
+                        testing::Values(static_cast<CacheFactory>(&NewTinyLFUCache)));
+
+class TwoQueueCacheTest : public CacheTest {
+};
+
+TEST_P(TwoQueueCacheTest, ReusedKeysSurviveScans) {
+    const int kReused = 100;
+    for (int i = 0; i < kReused; i++) {
+        Insert(i, i);
+    }
+    // Push them out of the cache, but not so far that their ghosts go.
+    for (int i = 1000; i < 1000 + kCacheSize + kCacheSize / 4; i++) {
+        Insert(i, i);
+    }
+    // Coming back, they go to the main queue.
+    for (int i = 0; i < kReused; i++) {
+        Insert(i, i);
+    }
+
+    // A scan of keys used once, ten times the capacity.
+    for (int i = 100000; i < 100000 + 10 * kCacheSize; i++) {
+        Insert(i, i);
+    }
+
+    for (int i = 0; i < kReused; i++) {
+        EXPECT_EQ(i, Lookup(i));
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(TwoQueue, TwoQueueCacheTest,
+                        testing::Values(static_cast<CacheFactory>(&NewTwoQueueCache)));
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <assert.h>
+#include <mutex>
+#include <stdlib.h>
+#include <vector>
+
+#include "components/lru_cache/cache.h"
+#include "components/lru_cache/lru_handle.h"
+#include "components/lru_cache/sharded_cache.h"
+#include "components/util/rcu.h"
+
+namespace {
+// CLOCK cache implementation
+//
+// Entries in the cache sit on a ring that a clock hand sweeps when space
+// is needed. The hand skips entries that are in use, clears the reference
+// bit of entries hit since it last passed and evicts the first entry with
+// the bit clear. A Lookup therefore writes nothing but the entry's
+// reference count and bit: it finds the entry without taking the mutex,
+// under an Rcu read lock, and pins it with LRUHandle::TryRef().
+//
+// Insert, Erase and eviction take the mutex. An entry whose last
+// reference is dropped has its value deleted at once, but its memory is
+// only freed once concurrent lookups that may still be reading it are
+// done; retired entries are freed in batches to amortize the wait.
+
+class ClockCache {
+public:
+    ClockCache();
+    ~ClockCache();
+
+    // Leaves any eviction to Evict().
+    void SetCapacity(size_t capacity) {
+        std::lock_guard<ShardMutex> l(mutex_);
+        capacity_ = capacity;
+    }
+
+    // Entries all have the same priority.
+    Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                          void* value, size_t charge,
+                          void (*deleter)(const Slice& key, void* value),
+                          Cache::Priority priority, uint64_t expire_time);
+
+    Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+
+    void Release(Cache::Handle* handle);
+
+    void Erase(const Slice& key, uint32_t hash);
+
+    void Prune();
+
+    // Evicts up to "max_count" entries while usage is above "target".
+    // Adds their charge to *freed and returns how many it evicted.
+    size_t Evict(size_t target, size_t max_count, size_t* freed) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        size_t count = EvictLocked(target, max_count, freed);
+        FreeRetired(&l, kRetireBatch);
+        return count;
+    }
+
+    void EvictExpired() {
+        std::unique_lock<ShardMutex> l(mutex_);
+        RemoveExpired(NowMillis());
+        FreeRetired(&l, kRetireBatch);
+    }
+
+    size_t TotalCharge() const {
+        std::lock_guard<ShardMutex> lock(mutex_);
+        return usage_;
+    }
+
+    void AddStats(Cache::Stats* stats) const {
+        mutex_.AddStats(stats);
+        std::lock_guard<ShardMutex> l(mutex_);
+        stats->charge += usage_;
+        stats->entry_overhead += entry_overhead_;
+        stats->table_overhead += table_.MemoryUsage();
+    }
+
+private:
+    static const size_t kRetireBatch = 64;
+
+    void Ring_Remove(LRUHandle* e);
+    void Ring_Insert(LRUHandle* e);
+    bool Unref(LRUHandle* e);
+    bool FinishErase(LRUHandle* e);
+    size_t EvictLocked(size_t target, size_t max_count, size_t* freed);
+    void RemoveExpired(uint64_t now);
+    void Retire(LRUHandle* e);
+    void FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count);
+
+    size_t capacity_;
+
+    mutable ShardMutex mutex_;
+    size_t usage_;
+    size_t entry_overhead_;     // HandleMemory() of the cached entries
+    size_t ring_size_;
+
+    // Dummy head of the ring; the hand passes over it.
+    LRUHandle ring_;
+    LRUHandle* hand_;
+    Rcu rcu_;
+    HandleTable table_;
+    ExpiryQueue expiry_;
+
+    std::vector<LRUHandle*> retired_;
+};
+
+ClockCache::ClockCache()
+  : capacity_(0),
+    usage_(0),
+    entry_overhead_(0),
+    ring_size_(0),
+    table_(&rcu_) {
+    // Make empty circular linked list.
+    ring_.next = &ring_;
+    ring_.prev = &ring_;
+    hand_ = &ring_;
+}
+
+ClockCache::~ClockCache() {
+    for (LRUHandle* e = ring_.next; e != &ring_; ) {
+        LRUHandle* next = e->next;
+        assert(e->in_cache);
+        e->in_cache = false;
+        assert(e->refs == 1);
+        if (Unref(e)) {
+            free(e);
+        }
+        e = next;
+    }
+    for (LRUHandle* e : retired_) {
+        free(e);
+    }
+}
+
+void ClockCache::Ring_Remove(LRUHandle* e) {
+    if (hand_ == e) {
+        hand_ = e->next;
+    }
+    e->next->prev = e->prev;
+    e->prev->next = e->next;
+    --ring_size_;
+}
+
+void ClockCache::Ring_Insert(LRUHandle* e) {
+    // Insert just behind the hand, so that "e" is looked at last.
+    e->next = hand_;
+    e->prev = hand_->prev;
+    e->prev->next = e;
+    e->next->prev = e;
+    ++ring_size_;
+}
+
+// Drops a reference to "e" and deletes its value if it was the last one.
+// Returns whether the caller must retire "e".
+bool ClockCache::Unref(LRUHandle* e) {
+    assert(e->refs > 0);
+    if (e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        assert(!e->in_cache);
+        (*e->deleter)(e->Key(), e->value);
+        return true;
+    }
+    return false;
+}
+
+// Queues "e" to be freed once no Lookup can be looking at it. Called with
+// mutex_ held; FreeRetired() does the freeing.
+void ClockCache::Retire(LRUHandle* e) {
+    retired_.push_back(e);
+}
+
+// Frees the retired entries if there are at least "min_count". Called with
+// "lock" held on mutex_. Waits for the grace period with the lock released,
+// as that can take long, and may return with it released.
+void ClockCache::FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count) {
+    if (retired_.empty() || retired_.size() < min_count) {
+        return;
+    }
+    std::vector<LRUHandle*> retired;
+    retired.swap(retired_);
+    retired_.reserve(kRetireBatch);
+    lock->unlock();
+
+    rcu_.Synchronize();
+    for (LRUHandle* e : retired) {
+        free(e);
+    }
+}
+
+Cache::Handle* ClockCache::Lookup(const Slice& key, uint32_t hash) {
+    Rcu::ReadLock lock(&rcu_);
+    LRUHandle* e = table_.Lookup(key, hash);
+    if (e == nullptr || e->Expired() || !e->TryRef()) {
+        return nullptr;
+    }
+    // Avoid dirtying the cache line when the bit is already set.
+    if (!e->referenced.load(std::memory_order_relaxed)) {
+        e->referenced.store(true, std::memory_order_relaxed);
+    }
+    return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCache::Release(Cache::Handle* handle) {
+    LRUHandle* e = reinterpret_cast<LRUHandle*>(handle);
+    if (Unref(e)) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        Retire(e);
+        FreeRetired(&l, kRetireBatch);
+    }
+}
+
+Cache::Handle* ClockCache::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value), Cache::Priority priority,
+    uint64_t expire_time) {
+
+    std::unique_lock<ShardMutex> l(mutex_);
+    if (!expiry_.Empty()) {
+        RemoveExpired(NowMillis());
+    }
+    const size_t limit = std::max(capacity_, usage_);
+
+    LRUHandle* e = NewLRUHandle(key, hash, value, charge, deleter, expire_time);
+
+    if (capacity_ > 0) {
+        e->refs++;  // for the cache's reference.
+        e->in_cache = true;
+        Ring_Insert(e);
+        usage_ += charge;
+        entry_overhead_ += HandleMemory(e);
+        FinishErase(table_.Insert(e));
+        expiry_.Add(e);
+    }  // else don't cache. (capacity_==0 is supported and turns off caching.)
+
+    size_t freed = 0;
+    EvictLocked(limit, SIZE_MAX, &freed);
+    EvictLocked(capacity_, kEvictBatch, &freed);
+    FreeRetired(&l, kRetireBatch);
+
+    return reinterpret_cast<Cache::Handle*>(e);
+}
+
+// Called with mutex_ held.
+size_t ClockCache::EvictLocked(size_t target, size_t max_count, size_t* freed) {
+    size_t count = 0;
+    // Each entry is passed at most twice: once to clear its bit, once to
+    // evict it. Entries in use are skipped.
+    size_t steps = 2 * ring_size_ + 2;
+    while (usage_ > target && count < max_count && steps-- > 0) {
+        LRUHandle* old = hand_;
+        hand_ = old->next;
+        if (old == &ring_ || old->refs.load(std::memory_order_relaxed) > 1) {
+            continue;
+        }
+        if (old->referenced.load(std::memory_order_relaxed)) {
+            old->referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        *freed += old->charge;
+        bool erased = FinishErase(table_.Remove(old->Key(), old->hash));
+        if (!erased) {  // to avoid unused variable when compiled NDEBUG
+            assert(erased);
+        }
+        count++;
+    }
+    return count;
+}
+
+// If e != nullptr, finish removing *e from the cache; it has already been
+// removed from the hash table.  Return whether e != nullptr.
+bool ClockCache::FinishErase(LRUHandle* e) {
+    if (e != nullptr) {
+        assert(e->in_cache);
+        Ring_Remove(e);
+        expiry_.Remove(e);
+        e->in_cache = false;
+        usage_ -= e->charge;
+        entry_overhead_ -= HandleMemory(e);
+        if (Unref(e)) {
+            Retire(e);
+        }
+    }
+    return e != nullptr;
+}
+
+// Erases the entries expired at "now". Called with mutex_ held.
+void ClockCache::RemoveExpired(uint64_t now) {
+    LRUHandle* e;
+    while ((e = expiry_.Expired(now)) != nullptr) {
+        bool erased = FinishErase(table_.Remove(e->Key(), e->hash));
+        if (!erased) {  // to avoid unused variable when compiled NDEBUG
+            assert(erased);
+        }
+    }
+}
+
+void ClockCache::Erase(const Slice& key, uint32_t hash) {
+    std::unique_lock<ShardMutex> l(mutex_);
+    FinishErase(table_.Remove(key, hash));
+    FreeRetired(&l, kRetireBatch);
+}
+
+void ClockCache::Prune() {
+    std::unique_lock<ShardMutex> l(mutex_);
+    for (LRUHandle* e = ring_.next; e != &ring_; ) {
+        LRUHandle* next = e->next;
+        if (e->refs.load(std::memory_order_relaxed) == 1) {
+            FinishErase(table_.Remove(e->Key(), e->hash));
+        }
+        e = next;
+    }
+    FreeRetired(&l, 1);
+}
+
+} // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity) {
+    return NewClockCache(capacity, ShardedCache<ClockCache>::kDefaultShardBits);
+}
+
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+    return new ShardedCache<ClockCache>(capacity, num_shard_bits);
+}
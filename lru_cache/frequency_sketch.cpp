@@ -0,0 +1,87 @@
+#include "components/lru_cache/frequency_sketch.h"
+
+namespace {
+
+const uint64_t kSeeds[] = {
+    0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull,
+    0x9ae16a3b2f90404full, 0xcbf29ce484222325ull,
+};
+
+const size_t kMinWidth = 64;
+
+}
+
+FrequencySketch::FrequencySketch()
+  : width_(0),
+    additions_(0),
+    sample_size_(0) {
+    EnsureCapacity(kMinWidth);
+}
+
+void FrequencySketch::EnsureCapacity(size_t entries) {
+    if (4 * entries <= width_) {
+        return;
+    }
+    // Four counters per row and entry keep collisions rare.
+    size_t width = kMinWidth;
+    while (width < 4 * entries) {
+        width *= 2;
+    }
+
+    // A counter's index within a row is the hash modulo the width, so a
+    // hash's counters in the wider table start out as copies of its
+    // counters now, and no estimate drops.
+    std::vector<uint64_t> table(kRows * width / 16, 0);
+    for (size_t i = 0; i < kRows * width; i++) {
+        size_t row = i / width;
+        size_t old = row * width_ + (i & (width_ - 1));
+        uint64_t count = width_ == 0 ? 0 : (table_[old / 16] >> ((old % 16) * 4)) & 0xf;
+        table[i / 16] |= count << ((i % 16) * 4);
+    }
+    table_.swap(table);
+    width_ = width;
+    // Ten additions per entry tracked, so that counts of keys that were
+    // popular a while ago fade before they keep new ones out for long.
+    sample_size_ = 10 * (width_ / 4);
+}
+
+size_t FrequencySketch::IndexOf(uint32_t hash, int row) const {
+    uint64_t h = (hash + kSeeds[row]) * kSeeds[row];
+    h += h >> 32;
+    return row * width_ + (h & (width_ - 1));
+}
+
+void FrequencySketch::Increment(uint32_t hash) {
+    bool added = false;
+    for (int row = 0; row < kRows; row++) {
+        size_t i = IndexOf(hash, row);
+        uint64_t& word = table_[i / 16];
+        int shift = (i % 16) * 4;
+        if (((word >> shift) & 0xf) < 0xf) {
+            word += uint64_t(1) << shift;
+            added = true;
+        }
+    }
+    if (added && ++additions_ >= sample_size_) {
+        Age();
+    }
+}
+
+int FrequencySketch::Frequency(uint32_t hash) const {
+    int frequency = 0xf;
+    for (int row = 0; row < kRows; row++) {
+        size_t i = IndexOf(hash, row);
+        int count = static_cast<int>((table_[i / 16] >> ((i % 16) * 4)) & 0xf);
+        if (count < frequency) {
+            frequency = count;
+        }
+    }
+    return frequency;
+}
+
+void FrequencySketch::Age() {
+    for (uint64_t& word : table_) {
+        word = (word >> 1) & 0x7777777777777777ull;
+    }
+    additions_ /= 2;
+}
@@ -0,0 +1,42 @@
+#ifndef COMPONENTS_LRU_CACHE_FREQUENCY_SKETCH_H_
+#define COMPONENTS_LRU_CACHE_FREQUENCY_SKETCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A count-min sketch estimating how often each hash was seen recently,
+// as used by TinyLFU admission.
+//
+// There are four rows of 4-bit counters, 16 to a word. An estimate is the
+// smallest of a hash's four counters, so it can only err upwards. After
+// ten increments per entry it makes room for, every counter is halved, so
+// that the sketch follows changes in popularity instead of saturating.
+//
+// Not thread-safe.
+class FrequencySketch {
+public:
+    FrequencySketch();
+
+    // Make room for tracking "entries" distinct hashes.
+    void EnsureCapacity(size_t entries);
+
+    void Increment(uint32_t hash);
+
+    // Estimated number of Increment(hash) calls, from 0 to 15.
+    int Frequency(uint32_t hash) const;
+
+private:
+    static const int kRows = 4;
+
+    size_t IndexOf(uint32_t hash, int row) const;
+    void Age();
+
+    std::vector<uint64_t> table_;
+    size_t width_;      // counters per row, a power of two
+    size_t additions_;
+    size_t sample_size_;
+
+}; // FrequencySketch
+
+#endif  // COMPONENTS_LRU_CACHE_FREQUENCY_SKETCH_H_
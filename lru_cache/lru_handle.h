@@ -0,0 +1,411 @@
+#ifndef COMPONENTS_LRU_CACHE_LRU_HANDLE_H_
+#define COMPONENTS_LRU_CACHE_LRU_HANDLE_H_
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "components/util/rcu.h"
+#include "components/util/slice.h"
+
+// Entries and the hash table shared by the cache implementations.
+//
+// An entry is a variable length heap-allocated structure. Entries are
+// linked into a circular doubly linked list (an LRU list, or the ring
+// of a CLOCK cache) and into a HandleTable.
+
+// Milliseconds on a monotonic clock, the unit of LRUHandle::expire_time.
+inline uint64_t NowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct LRUHandle {
+    void* value;
+    void (*deleter)(const Slice&, void* value);
+    std::atomic<LRUHandle*> next_hash;
+    LRUHandle* next;
+    LRUHandle* prev;
+    size_t charge;
+    size_t key_length;
+    uint64_t expire_time;   // NowMillis() from which the entry is stale, or 0.
+    bool in_cache;      // Whether entry is in the cache.
+    uint8_t queue;      // List the entry is on, for caches with several.
+    std::atomic<bool> referenced;   // Hit since the clock hand last passed.
+    std::atomic<uint32_t> refs;     // References, including cache reference, if present.
+    uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+    char key_data[1];   // Beginning of key
+
+    Slice Key() const {
+        // next_ is only equal to this if the LRU handle is the list head of an
+        // empty list. List heads never have meaningful keys.
+        assert(next != this);
+
+        return Slice(key_data, key_length);
+    }
+
+    // Whether the entry's time to live has passed. Reads the clock only
+    // for entries that have one.
+    bool Expired() const {
+        return expire_time != 0 && NowMillis() >= expire_time;
+    }
+
+    // Takes a reference unless the count already dropped to zero, i.e.
+    // the entry is being freed. For readers that found "this" without
+    // holding the cache's lock.
+    bool TryRef() {
+        uint32_t r = refs.load(std::memory_order_relaxed);
+        while (r > 0) {
+            if (refs.compare_exchange_weak(r, r + 1, std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Allocates an entry holding one reference, for the returned handle.
+inline LRUHandle* NewLRUHandle(const Slice& key, uint32_t hash, void* value, size_t charge,
+                               void (*deleter)(const Slice& key, void* value),
+                               uint64_t expire_time) {
+    LRUHandle* e = reinterpret_cast<LRUHandle*>(
+        malloc(sizeof(LRUHandle)-1 + key.Size()));
+    e->value = value;
+    e->deleter = deleter;
+    e->next_hash.store(nullptr, std::memory_order_relaxed);
+    // next is read by key() in an assert, so it must be initialized
+    e->next = nullptr;
+    e->prev = nullptr;
+    e->charge = charge;
+    e->key_length = key.Size();
+    e->expire_time = expire_time;
+    e->hash = hash;
+    e->in_cache = false;
+    e->queue = 0;
+    e->referenced.store(false, std::memory_order_relaxed);
+    e->refs.store(1, std::memory_order_relaxed);
+    memcpy(e->key_data, key.Data(), key.Size());
+    return e;
+}
+
+// Heap memory taken by "e", its key included, as the allocator counts it
+// where it can tell.
+inline size_t HandleMemory(LRUHandle* e) {
+#if defined(__GLIBC__)
+    return malloc_usable_size(e);
+#else
+    return sizeof(LRUHandle) - 1 + e->key_length;
+#endif
+}
+
+// The cached entries that have a time to live, soonest to expire first,
+// so that a shard can drop expired entries without scanning all of them.
+// Shards add an entry when it enters the cache and remove it when it
+// leaves, under their mutex.
+class ExpiryQueue {
+public:
+    bool Empty() const { return queue_.empty(); }
+
+    void Add(LRUHandle* e) {
+        if (e->expire_time != 0) {
+            queue_.emplace(e->expire_time, e);
+        }
+    }
+
+    void Remove(LRUHandle* e) {
+        if (e->expire_time == 0) {
+            return;
+        }
+        auto range = queue_.equal_range(e->expire_time);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == e) {
+                queue_.erase(it);
+                return;
+            }
+        }
+        assert(false);
+    }
+
+    // Returns an entry that is expired at "now", or nullptr if none is.
+    LRUHandle* Expired(uint64_t now) const {
+        if (queue_.empty() || queue_.begin()->first > now) {
+            return nullptr;
+        }
+        return queue_.begin()->second;
+    }
+
+private:
+    std::multimap<uint64_t, LRUHandle*> queue_;
+};
+
+// We provide our own simple hash table since it removes a whole bunch
+// of porting hacks and is also faster than some of the built-in hash
+// table implementations in some of the compiler/runtime combinations
+// we have tested.
+//
+// The table uses open addressing. Slots come in groups of seven that
+// fill a cache line together with a 64-bit word of control bytes, one
+// per slot: empty, deleted, or 7 bits of the hash of the entry in the
+// slot. A probe matches all control bytes of a group at once with a few
+// integer operations and only looks at entries whose bits match, so a
+// miss usually reads one cache line and a hit two, the group's and the
+// entry's.
+//
+// Insert and Remove must be serialized by the caller. Lookup may run
+// concurrently with them: a slot's entry is stored before its control
+// byte, and a deleted slot keeps pointing at its old entry, so a reader
+// that matches a control byte always finds an entry to compare keys
+// with. A reader racing with a rehash may miss an entry, which to a
+// cache is just a miss. Replaced slot arrays are freed once concurrent
+// readers, which must hold a ReadLock of "rcu", are done with them.
+// Callers must likewise keep removed entries alive until concurrent
+// readers are done with them.
+class HandleTable {
+public:
+    explicit HandleTable(Rcu* rcu)
+      : rcu_(rcu),
+        elems_(0),
+        tombstones_(0),
+        array_(new Array(1)) {
+    }
+
+    ~HandleTable() {
+        delete array_.load();
+    }
+
+    HandleTable(const HandleTable&) = delete;
+    HandleTable& operator=(const HandleTable&) = delete;
+
+    LRUHandle* Lookup(const Slice& key, uint32_t hash) const {
+        size_t index;
+        return Find(array_.load(std::memory_order_acquire), key, hash,
+                    std::memory_order_acquire, &index);
+    }
+
+    LRUHandle* Insert(LRUHandle* h) {
+        Array* array = array_.load(std::memory_order_relaxed);
+        size_t index;
+        LRUHandle* old = Find(array, h->Key(), h->hash, std::memory_order_relaxed, &index);
+        if (old != nullptr) {
+            array->Slot(index).store(h, std::memory_order_release);
+            return old;
+        }
+
+        // Keep at least one empty slot in eight so that probes stay short
+        // and end.
+        if ((elems_ + tombstones_ + 1) * 8 > array->Capacity() * 7) {
+            Rehash();
+            array = array_.load(std::memory_order_relaxed);
+        }
+        index = FindFree(array, h->hash);
+        if (GetCtrl(array, index) == kDeleted) {
+            --tombstones_;
+        }
+        // Release, too: a reader that loaded the control word before the
+        // slot was deleted may still match it and read the new entry.
+        array->Slot(index).store(h, std::memory_order_release);
+        SetCtrl(array, index, Tag(h->hash));
+        ++elems_;
+        return nullptr;
+    }
+
+    LRUHandle* Remove(const Slice& key, uint32_t hash) {
+        Array* array = array_.load(std::memory_order_relaxed);
+        size_t index;
+        LRUHandle* result = Find(array, key, hash, std::memory_order_relaxed, &index);
+        if (result != nullptr) {
+            // No probe goes past a group with an empty slot, so the slot
+            // need not be marked deleted to keep later groups reachable.
+            if (MatchEmpty(array->Ctrl(index).load(std::memory_order_relaxed))) {
+                SetCtrl(array, index, kEmpty);
+            } else {
+                SetCtrl(array, index, kDeleted);
+                ++tombstones_;
+            }
+            --elems_;
+        }
+        return result;
+    }
+
+    // Heap memory of the slot array. Not for concurrent readers.
+    size_t MemoryUsage() const {
+        const Array* array = array_.load(std::memory_order_relaxed);
+        return sizeof(Array) + (array->mask + 1) * sizeof(Group) + kCacheLineSize;
+    }
+
+private:
+    static const size_t kGroupSize = 7;
+    static const size_t kCacheLineSize = 64;
+
+    // Control bytes. Full slots hold 7 bits of the hash; the eighth byte
+    // of a control word, which has no slot, holds kNoSlot.
+    static const uint8_t kEmpty = 0x80;
+    static const uint8_t kDeleted = 0xfe;
+    static const uint8_t kNoSlot = 0xff;
+
+    static const uint64_t kLsbs = 0x0101010101010101ull;
+    static const uint64_t kMsbs = 0x0080808080808080ull;   // but the eighth byte's
+
+    struct Group {
+        std::atomic<uint64_t> ctrl;
+        std::atomic<LRUHandle*> slots[kGroupSize];
+    };
+    static_assert(sizeof(Group) == kCacheLineSize, "a group fills a cache line");
+
+    // Slot indexes are group << 3 | slot within the group.
+    struct Array {
+        explicit Array(size_t n)
+          : mask(n - 1),
+            memory(malloc(n * sizeof(Group) + kCacheLineSize)) {
+            uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory) + kCacheLineSize - 1) &
+                                ~uintptr_t(kCacheLineSize - 1);
+            groups = reinterpret_cast<Group*>(aligned);
+            for (size_t g = 0; g < n; g++) {
+                groups[g].ctrl.store(kLsbs * kEmpty | uint64_t(kNoSlot) << 56,
+                                     std::memory_order_relaxed);
+                for (size_t i = 0; i < kGroupSize; i++) {
+                    groups[g].slots[i].store(nullptr, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        ~Array() { free(memory); }
+
+        size_t Capacity() const { return (mask + 1) * kGroupSize; }
+
+        std::atomic<uint64_t>& Ctrl(size_t index) const { return groups[index >> 3].ctrl; }
+        std::atomic<LRUHandle*>& Slot(size_t index) const {
+            return groups[index >> 3].slots[index & 7];
+        }
+
+        const size_t mask;      // number of groups - 1
+        void* const memory;
+        Group* groups;
+    };
+
+    Rcu* const rcu_;
+    size_t elems_;
+    size_t tombstones_;
+    std::atomic<Array*> array_;
+
+    // Entries of a cache shard share the top bits of their hash, so mix
+    // it before taking bits for the group and the tag.
+    static uint64_t Mix(uint32_t hash) {
+        return hash * 0x9E3779B97F4A7C15ull;
+    }
+
+    static uint8_t Tag(uint32_t hash) {
+        return static_cast<uint8_t>(Mix(hash) >> 57);
+    }
+
+    static size_t FirstGroup(const Array* array, uint32_t hash) {
+        return static_cast<size_t>(Mix(hash) >> 32) & array->mask;
+    }
+
+    // High bit set in every byte of "word" equal to "b", and possibly in
+    // a few others above a matching byte. Never in the eighth byte.
+    static uint64_t MatchByte(uint64_t word, uint8_t b) {
+        uint64_t x = word ^ (kLsbs * b);
+        return (x - kLsbs) & ~x & kMsbs;
+    }
+
+    // High bit set in every empty byte: kEmpty has bit 1 clear, kDeleted
+    // and kNoSlot have it set, and full bytes have bit 7 clear.
+    static uint64_t MatchEmpty(uint64_t word) {
+        return word & ~(word << 6) & kMsbs;
+    }
+
+    static uint64_t MatchEmptyOrDeleted(uint64_t word) {
+        return word & kMsbs;
+    }
+
+    static size_t LowestByte(uint64_t match) {
+        return __builtin_ctzll(match) / 8;
+    }
+
+    static uint8_t GetCtrl(const Array* array, size_t index) {
+        uint64_t word = array->Ctrl(index).load(std::memory_order_relaxed);
+        return static_cast<uint8_t>(word >> ((index & 7) * 8));
+    }
+
+    static void SetCtrl(Array* array, size_t index, uint8_t b) {
+        std::atomic<uint64_t>& ctrl = array->Ctrl(index);
+        const int shift = (index & 7) * 8;
+        uint64_t word = ctrl.load(std::memory_order_relaxed);
+        word = (word & ~(uint64_t(0xff) << shift)) | (uint64_t(b) << shift);
+        ctrl.store(word, std::memory_order_release);
+    }
+
+    // Groups are probed with triangular steps, which visit every group
+    // of a power of two sized array.
+    static LRUHandle* Find(const Array* array, const Slice& key, uint32_t hash,
+                           std::memory_order order, size_t* index) {
+        const uint8_t tag = Tag(hash);
+        size_t g = FirstGroup(array, hash);
+        for (size_t step = 1; ; step++) {
+            uint64_t word = array->groups[g].ctrl.load(order);
+            for (uint64_t m = MatchByte(word, tag); m != 0; m &= m - 1) {
+                size_t i = g << 3 | LowestByte(m);
+                LRUHandle* h = array->Slot(i).load(order);
+                // Not h->Key(): its assert reads "next", which the writer
+                // may be changing.
+                if (h != nullptr && h->hash == hash &&
+                    key == Slice(h->key_data, h->key_length)) {
+                    *index = i;
+                    return h;
+                }
+            }
+            if (MatchEmpty(word) != 0) {
+                return nullptr;
+            }
+            g = (g + step) & array->mask;
+        }
+    }
+
+    static size_t FindFree(const Array* array, uint32_t hash) {
+        size_t g = FirstGroup(array, hash);
+        for (size_t step = 1; ; step++) {
+            uint64_t m = MatchEmptyOrDeleted(array->groups[g].ctrl.load(std::memory_order_relaxed));
+            if (m != 0) {
+                return g << 3 | LowestByte(m);
+            }
+            g = (g + step) & array->mask;
+        }
+    }
+
+    // Moves the entries to a new array, twice as large unless most of the
+    // used slots are deleted ones.
+    void Rehash() {
+        Array* old_array = array_.load(std::memory_order_relaxed);
+        size_t groups = old_array->mask + 1;
+        if ((elems_ + 1) * 16 > old_array->Capacity() * 7) {
+            groups *= 2;
+        }
+        Array* array = new Array(groups);
+        for (size_t i = 0; i <= (old_array->mask << 3 | 7); i++) {
+            if (GetCtrl(old_array, i) & kEmpty) {
+                continue;   // empty, deleted or no slot
+            }
+            LRUHandle* h = old_array->Slot(i).load(std::memory_order_relaxed);
+            size_t index = FindFree(array, h->hash);
+            array->Slot(index).store(h, std::memory_order_relaxed);
+            SetCtrl(array, index, Tag(h->hash));
+        }
+        tombstones_ = 0;
+        array_.store(array, std::memory_order_release);
+        rcu_->Synchronize();
+        delete old_array;
+    }
+};
+
+#endif  // COMPONENTS_LRU_CACHE_LRU_HANDLE_H_
@@ -0,0 +1,370 @@
+#ifndef COMPONENTS_LRU_CACHE_SHARDED_CACHE_H_
+#define COMPONENTS_LRU_CACHE_SHARDED_CACHE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "components/lru_cache/cache.h"
+#include "components/lru_cache/lru_handle.h"
+#include "components/util/hash.h"
+
+// Most entries a shard evicts in one hold of its mutex on its way down to
+// a lowered capacity.
+const size_t kEvictBatch = 64;
+
+// Mutex of a cache shard. Counts how often it is taken and how often the
+// caller had to wait, to tell whether a cache has enough shards.
+class ShardMutex {
+public:
+    ShardMutex() : acquisitions_(0), contentions_(0) { }
+
+    void lock() {
+        if (!mutex_.try_lock()) {
+            contentions_.fetch_add(1, std::memory_order_relaxed);
+            mutex_.lock();
+        }
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unlock() { mutex_.unlock(); }
+
+    void AddStats(Cache::Stats* stats) const {
+        stats->lock_acquisitions += acquisitions_.load(std::memory_order_relaxed);
+        stats->lock_contentions += contentions_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex mutex_;
+    std::atomic<uint64_t> acquisitions_;
+    std::atomic<uint64_t> contentions_;
+};
+
+// Spreads keys over 2^num_shard_bits independent caches by the top bits
+// of their hash, so that operations on different shards do not contend.
+//
+// "Shard" implements one policy (LRU, CLOCK, ...) over LRUHandles and
+// provides SetCapacity, Insert, Lookup, Release, Erase, Prune,
+// EvictExpired, TotalCharge taking the key's hash, and AddStats. Insert
+// takes the entry's expire time rather than its time to live. It also
+// provides Evict(target, max_count, &freed), which evicts at most
+// max_count entries in one hold of its mutex, so that large evictions
+// can be split up. SetCapacity leaves eviction to Evict, and Insert
+// evicts what makes room for the new entry plus at most kEvictBatch
+// entries, so that an Insert racing with SetCapacity does not take over
+// the whole shrink.
+template<class Shard>
+class ShardedCache : public Cache {
+public:
+    static const int kDefaultShardBits = 4;
+    static const int kMaxShardBits = 8;
+
+    // Negative "num_shard_bits" picks the count with AutoShardBits().
+    ShardedCache(size_t capacity, int num_shard_bits)
+      : num_shard_bits_(num_shard_bits < 0 ? AutoShardBits(capacity) :
+                        num_shard_bits > kMaxShardBits ? int(kMaxShardBits) : num_shard_bits),
+        num_shards_(1 << num_shard_bits_),
+        shard_(new Shard[num_shards_]),
+        loads_(new LoadTable[num_shards_]),
+        capacity_(capacity),
+        last_id_(0),
+        num_loads_(0),
+        num_load_waits_(0),
+        sweep_interval_ms_(0),
+        stop_sweeper_(false) {
+        for (int s = 0; s < num_shards_; s++) {
+            shard_[s].SetCapacity(PerShard(capacity));
+        }
+    }
+
+    // The sweeper must be gone before the shards are.
+    virtual ~ShardedCache() {
+        StopExpirySweeper();
+    }
+
+    // About two shards per hardware thread, so that threads rarely meet on
+    // a shard, but no more than leave each shard kMinShardCapacity: small
+    // shards waste capacity, as keys do not split evenly between them.
+    static int AutoShardBits(size_t capacity) {
+        unsigned threads = std::thread::hardware_concurrency();
+        int bits = 0;
+        while (bits < kMaxShardBits &&
+               (1u << bits) < 2 * threads &&
+               (capacity >> (bits + 1)) >= kMinShardCapacity) {
+            bits++;
+        }
+        return bits;
+    }
+
+    virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                           void (*deleter)(const Slice& key, void* value),
+                           Priority priority = Priority::LOW,
+                           uint32_t ttl_ms = 0) {
+        const uint32_t hash = HashSlice(key);
+        return shard_[ShardOf(hash)].Insert(key, hash, value, charge, deleter, priority,
+                                            ExpireTime(ttl_ms));
+    }
+
+    virtual Handle* Lookup(const Slice& key) {
+        const uint32_t hash = HashSlice(key);
+        return shard_[ShardOf(hash)].Lookup(key, hash);
+    }
+
+    virtual Handle* GetOrLoad(const Slice& key, const Loader& loader,
+                              void (*deleter)(const Slice& key, void* value),
+                              Priority priority = Priority::LOW,
+                              uint32_t ttl_ms = 0) {
+        const uint32_t hash = HashSlice(key);
+        Shard& shard = shard_[ShardOf(hash)];
+        Handle* handle = shard.Lookup(key, hash);
+        if (handle != nullptr) {
+            return handle;
+        }
+
+        LoadTable& table = loads_[ShardOf(hash)];
+        const std::string key_string(key.Data(), key.Size());
+        std::shared_ptr<PendingLoad> load;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> l(table.mutex);
+            // A load that finished since the lookup inserted its value
+            // before leaving the table.
+            handle = shard.Lookup(key, hash);
+            if (handle != nullptr) {
+                return handle;
+            }
+            auto it = table.loads.find(key_string);
+            if (it != table.loads.end()) {
+                load = it->second;
+                load->waiters++;
+            } else {
+                load = std::make_shared<PendingLoad>();
+                table.loads.emplace(key_string, load);
+                leader = true;
+            }
+        }
+
+        if (!leader) {
+            num_load_waits_.fetch_add(1, std::memory_order_relaxed);
+            std::unique_lock<std::mutex> l(load->mutex);
+            load->done_cond.wait(l, [&load] { return load->done; });
+            return load->handle;
+        }
+
+        num_loads_.fetch_add(1, std::memory_order_relaxed);
+        void* value;
+        size_t charge;
+        if (loader(key, &value, &charge)) {
+            handle = shard.Insert(key, hash, value, charge, deleter, priority,
+                                  ExpireTime(ttl_ms));
+        }
+        size_t waiters;
+        {
+            std::lock_guard<std::mutex> l(table.mutex);
+            table.loads.erase(key_string);
+            waiters = load->waiters;
+        }
+        // One reference for each waiter, taken while ours keeps the entry.
+        if (handle != nullptr && waiters > 0) {
+            reinterpret_cast<LRUHandle*>(handle)->refs.fetch_add(waiters, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> l(load->mutex);
+            load->done = true;
+            load->handle = handle;
+        }
+        load->done_cond.notify_all();
+        return handle;
+    }
+
+    virtual void Release(Handle* handle) {
+        LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
+        shard_[ShardOf(h->hash)].Release(handle);
+    }
+
+    virtual void Erase(const Slice& key) {
+        const uint32_t hash = HashSlice(key);
+        shard_[ShardOf(hash)].Erase(key, hash);
+    }
+
+    virtual void* Value(Handle* handle) {
+        return reinterpret_cast<LRUHandle*>(handle)->value;
+    }
+
+    virtual uint64_t NewId() {
+        return last_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    virtual void Prune() {
+        for (int s = 0; s < num_shards_; s++) {
+            shard_[s].Prune();
+        }
+    }
+
+    virtual void EvictExpired() {
+        for (int s = 0; s < num_shards_; s++) {
+            shard_[s].EvictExpired();
+        }
+    }
+
+    virtual void StartExpirySweeper(uint32_t interval_ms) {
+        std::lock_guard<std::mutex> control(sweeper_control_mutex_);
+        std::lock_guard<std::mutex> l(sweeper_mutex_);
+        sweep_interval_ms_ = std::max<uint32_t>(interval_ms, 1);
+        if (!sweeper_.joinable()) {
+            stop_sweeper_ = false;
+            sweeper_ = std::thread([this] { SweepExpired(); });
+        }
+    }
+
+    virtual void StopExpirySweeper() {
+        std::lock_guard<std::mutex> control(sweeper_control_mutex_);
+        {
+            std::lock_guard<std::mutex> l(sweeper_mutex_);
+            if (!sweeper_.joinable()) {
+                return;
+            }
+            stop_sweeper_ = true;
+        }
+        sweeper_cond_.notify_one();
+        sweeper_.join();
+    }
+
+    virtual size_t TotalCharge() const {
+        size_t total = 0;
+        for (int s = 0; s < num_shards_; s++) {
+            total += shard_[s].TotalCharge();
+        }
+        return total;
+    }
+
+    virtual void SetCapacity(size_t capacity) {
+        capacity_.store(capacity, std::memory_order_relaxed);
+        for (int s = 0; s < num_shards_; s++) {
+            shard_[s].SetCapacity(PerShard(capacity));
+            EvictTo(&shard_[s], PerShard(capacity));
+        }
+    }
+
+    virtual size_t GetCapacity() const {
+        return capacity_.load(std::memory_order_relaxed);
+    }
+
+    virtual size_t Shed(size_t charge) {
+        // Take from each shard in proportion to its usage.
+        std::vector<size_t> usage(num_shards_);
+        size_t total = 0;
+        for (int s = 0; s < num_shards_; s++) {
+            usage[s] = shard_[s].TotalCharge();
+            total += usage[s];
+        }
+        size_t freed = 0;
+        for (int s = 0; s < num_shards_ && total > 0; s++) {
+            size_t share = charge >= total ? usage[s] :
+                           static_cast<size_t>(static_cast<double>(charge) * usage[s] / total) + 1;
+            freed += EvictTo(&shard_[s], usage[s] > share ? usage[s] - share : 0);
+        }
+        return freed;
+    }
+
+    // Calls f(Shard*) for every shard, e.g. to configure them.
+    template<class F>
+    void ForEachShard(F f) {
+        for (int s = 0; s < num_shards_; s++) {
+            f(&shard_[s]);
+        }
+    }
+
+    virtual Stats GetStats() const {
+        Stats stats;
+        stats.num_shards = num_shards_;
+        stats.loads = num_loads_.load(std::memory_order_relaxed);
+        stats.load_waits = num_load_waits_.load(std::memory_order_relaxed);
+        for (int s = 0; s < num_shards_; s++) {
+            shard_[s].AddStats(&stats);
+        }
+        return stats;
+    }
+
+private:
+    // A GetOrLoad() in progress. Waiters register in the load table under
+    // its mutex, so once the load is out of the table its loader knows how
+    // many references to hand out.
+    struct PendingLoad {
+        std::mutex mutex;
+        std::condition_variable done_cond;
+        bool done = false;
+        Handle* handle = nullptr;
+        size_t waiters = 0;     // guarded by LoadTable::mutex
+    };
+
+    struct LoadTable {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<PendingLoad>> loads;
+    };
+
+    const int num_shard_bits_;
+    const int num_shards_;
+    std::unique_ptr<Shard[]> shard_;
+    std::unique_ptr<LoadTable[]> loads_;   // per shard
+    std::atomic<size_t> capacity_;
+    std::atomic<uint64_t> last_id_;
+    std::atomic<uint64_t> num_loads_;
+    std::atomic<uint64_t> num_load_waits_;
+
+    // Serializes StartExpirySweeper() and StopExpirySweeper(), so that a
+    // sweeper being stopped is joined before another starts.
+    std::mutex sweeper_control_mutex_;
+    std::mutex sweeper_mutex_;      // guards the interval, stop_sweeper_ and sweeper_
+    std::condition_variable sweeper_cond_;
+    uint32_t sweep_interval_ms_;
+    bool stop_sweeper_;
+    std::thread sweeper_;
+
+    static inline uint32_t HashSlice(const Slice& s) {
+        return Hash(s.Data(), s.Size(), 0);
+    }
+
+    size_t PerShard(size_t capacity) const {
+        return (capacity + (num_shards_ - 1)) / num_shards_;
+    }
+
+    // Evicts from "shard" until its usage is at most "target" or only
+    // entries in use are left, kEvictBatch entries per hold of its mutex.
+    // Returns the charge freed.
+    static size_t EvictTo(Shard* shard, size_t target) {
+        size_t freed = 0;
+        while (shard->Evict(target, kEvictBatch, &freed) == kEvictBatch) {
+        }
+        return freed;
+    }
+
+    // Body of the expiry sweeper thread.
+    void SweepExpired() {
+        std::unique_lock<std::mutex> l(sweeper_mutex_);
+        while (!sweeper_cond_.wait_for(l, std::chrono::milliseconds(sweep_interval_ms_),
+                                       [this] { return stop_sweeper_; })) {
+            l.unlock();
+            EvictExpired();
+            l.lock();
+        }
+    }
+
+    static uint64_t ExpireTime(uint32_t ttl_ms) {
+        return ttl_ms == 0 ? 0 : NowMillis() + ttl_ms;
+    }
+
+    uint32_t ShardOf(uint32_t hash) const {
+        return num_shard_bits_ == 0 ? 0 : hash >> (32 - num_shard_bits_);
+    }
+};
+
+#endif  // COMPONENTS_LRU_CACHE_SHARDED_CACHE_H_
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <assert.h>
+#include <deque>
+#include <mutex>
+#include <stdlib.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "components/lru_cache/cache.h"
+#include "components/lru_cache/lru_handle.h"
+#include "components/lru_cache/sharded_cache.h"
+#include "components/util/rcu.h"
+
+namespace {
+// 2Q cache implementation
+//
+// A new entry goes to a1in_, a FIFO queue holding up to a quarter of the
+// capacity. Entries pushed out of a1in_ leave their key's hash in a1out_,
+// a list of "ghosts" that remembers as much charge as half the capacity.
+// A key that is inserted again while its ghost is still there has proved
+// to be used more than once and goes to am_, the main queue. So one-off
+// keys pass through a1in_ without disturbing am_, while keys that are
+// reused, even at intervals longer than a1in_ lasts, are kept in am_.
+//
+// am_ is evicted in LRU order, approximated like a CLOCK: a Lookup only
+// sets the entry's reference bit, and eviction moves entries whose bit
+// is set to the newest end instead of evicting them. Lookups take no
+// lock, as in ClockCache, and retired entries are freed the same way.
+
+class TwoQueueCache {
+public:
+    TwoQueueCache();
+    ~TwoQueueCache();
+
+    // Leaves any eviction to Evict().
+    void SetCapacity(size_t capacity) {
+        std::lock_guard<ShardMutex> l(mutex_);
+        capacity_ = capacity;
+    }
+
+    // Entries all have the same priority.
+    Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                          void* value, size_t charge,
+                          void (*deleter)(const Slice& key, void* value),
+                          Cache::Priority priority, uint64_t expire_time);
+
+    Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+
+    void Release(Cache::Handle* handle);
+
+    void Erase(const Slice& key, uint32_t hash);
+
+    void Prune();
+
+    // Evicts up to "max_count" entries while usage is above "target".
+    // Adds their charge to *freed and returns how many it evicted.
+    size_t Evict(size_t target, size_t max_count, size_t* freed) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        size_t count = EvictLocked(target, max_count, freed);
+        FreeRetired(&l, kRetireBatch);
+        return count;
+    }
+
+    void EvictExpired() {
+        std::unique_lock<ShardMutex> l(mutex_);
+        RemoveExpired(NowMillis());
+        FreeRetired(&l, kRetireBatch);
+    }
+
+    size_t TotalCharge() const {
+        std::lock_guard<ShardMutex> lock(mutex_);
+        return usage_;
+    }
+
+    void AddStats(Cache::Stats* stats) const {
+        mutex_.AddStats(stats);
+        std::lock_guard<ShardMutex> l(mutex_);
+        stats->charge += usage_;
+        stats->entry_overhead += entry_overhead_;
+        stats->table_overhead += table_.MemoryUsage();
+    }
+
+private:
+    enum Queue { A1IN = 0, AM = 1 };
+
+    static const size_t kRetireBatch = 64;
+
+    void Queue_Remove(LRUHandle* e);
+    void Queue_Append(Queue queue, LRUHandle* e);
+    LRUHandle* Oldest(LRUHandle* list) const;
+    LRUHandle* Victim();
+    void Remember(uint32_t hash, size_t charge);
+    bool Unref(LRUHandle* e);
+    bool FinishErase(LRUHandle* e);
+    size_t EvictLocked(size_t target, size_t max_count, size_t* freed);
+    void RemoveExpired(uint64_t now);
+    void Retire(LRUHandle* e);
+    void FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count);
+
+    size_t capacity_;
+
+    mutable ShardMutex mutex_;
+    size_t usage_;
+    size_t entry_overhead_;     // HandleMemory() of the cached entries
+    size_t a1in_usage_;
+    size_t am_size_;
+
+    // Dummy heads of the queues; head.next is the oldest entry.
+    LRUHandle a1in_;
+    LRUHandle am_;
+    Rcu rcu_;
+    HandleTable table_;
+    ExpiryQueue expiry_;
+
+    // Hashes and charges of keys evicted from a1in_, oldest first, and
+    // how often each hash occurs in it.
+    std::deque<std::pair<uint32_t, size_t>> a1out_;
+    std::unordered_map<uint32_t, int> a1out_hashes_;
+    size_t a1out_charge_;
+
+    std::vector<LRUHandle*> retired_;
+};
+
+TwoQueueCache::TwoQueueCache()
+  : capacity_(0),
+    usage_(0),
+    entry_overhead_(0),
+    a1in_usage_(0),
+    am_size_(0),
+    table_(&rcu_),
+    a1out_charge_(0) {
+    // Make empty circular linked lists.
+    a1in_.next = &a1in_;
+    a1in_.prev = &a1in_;
+    am_.next = &am_;
+    am_.prev = &am_;
+}
+
+TwoQueueCache::~TwoQueueCache() {
+    for (LRUHandle* list : {&a1in_, &am_}) {
+        for (LRUHandle* e = list->next; e != list; ) {
+            LRUHandle* next = e->next;
+            assert(e->in_cache);
+            e->in_cache = false;
+            assert(e->refs == 1);
+            if (Unref(e)) {
+                free(e);
+            }
+            e = next;
+        }
+    }
+    for (LRUHandle* e : retired_) {
+        free(e);
+    }
+}
+
+void TwoQueueCache::Queue_Remove(LRUHandle* e) {
+    e->next->prev = e->prev;
+    e->prev->next = e->next;
+    if (e->queue == A1IN) {
+        a1in_usage_ -= e->charge;
+    } else {
+        --am_size_;
+    }
+}
+
+void TwoQueueCache::Queue_Append(Queue queue, LRUHandle* e) {
+    LRUHandle* list = queue == A1IN ? &a1in_ : &am_;
+    e->queue = queue;
+    e->next = list;
+    e->prev = list->prev;
+    e->prev->next = e;
+    e->next->prev = e;
+    if (queue == A1IN) {
+        a1in_usage_ += e->charge;
+    } else {
+        ++am_size_;
+    }
+}
+
+// Drops a reference to "e" and deletes its value if it was the last one.
+// Returns whether the caller must retire "e".
+bool TwoQueueCache::Unref(LRUHandle* e) {
+    assert(e->refs > 0);
+    if (e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        assert(!e->in_cache);
+        (*e->deleter)(e->Key(), e->value);
+        return true;
+    }
+    return false;
+}
+
+// Queues "e" to be freed once no Lookup can be looking at it. Called with
+// mutex_ held; FreeRetired() does the freeing.
+void TwoQueueCache::Retire(LRUHandle* e) {
+    retired_.push_back(e);
+}
+
+// Frees the retired entries if there are at least "min_count". Called with
+// "lock" held on mutex_. Waits for the grace period with the lock released,
+// as that can take long, and may return with it released.
+void TwoQueueCache::FreeRetired(std::unique_lock<ShardMutex>* lock, size_t min_count) {
+    if (retired_.empty() || retired_.size() < min_count) {
+        return;
+    }
+    std::vector<LRUHandle*> retired;
+    retired.swap(retired_);
+    retired_.reserve(kRetireBatch);
+    lock->unlock();
+
+    rcu_.Synchronize();
+    for (LRUHandle* e : retired) {
+        free(e);
+    }
+}
+
+void TwoQueueCache::Remember(uint32_t hash, size_t charge) {
+    a1out_.push_back(std::make_pair(hash, charge));
+    a1out_hashes_[hash]++;
+    a1out_charge_ += charge;
+    while (a1out_charge_ > capacity_ / 2) {
+        auto it = a1out_hashes_.find(a1out_.front().first);
+        if (--it->second == 0) {
+            a1out_hashes_.erase(it);
+        }
+        a1out_charge_ -= a1out_.front().second;
+        a1out_.pop_front();
+    }
+}
+
+LRUHandle* TwoQueueCache::Oldest(LRUHandle* list) const {
+    for (LRUHandle* e = list->next; e != list; e = e->next) {
+        if (e->refs.load(std::memory_order_relaxed) == 1) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+// The entry to evict next, or nullptr if all are in use.
+LRUHandle* TwoQueueCache::Victim() {
+    if (a1in_usage_ > capacity_ / 4) {
+        LRUHandle* e = Oldest(&a1in_);
+        if (e != nullptr) {
+            return e;
+        }
+    }
+    // Each entry is passed at most twice: once to clear its bit, once to
+    // evict it.
+    LRUHandle* e = am_.next;
+    for (size_t steps = 2 * am_size_; e != &am_ && steps > 0; steps--) {
+        LRUHandle* next = e->next;
+        if (e->refs.load(std::memory_order_relaxed) == 1) {
+            if (!e->referenced.load(std::memory_order_relaxed)) {
+                return e;
+            }
+            e->referenced.store(false, std::memory_order_relaxed);
+            Queue_Remove(e);
+            Queue_Append(AM, e);
+        }
+        e = next == &am_ ? am_.next : next;
+    }
+    return Oldest(&a1in_);
+}
+
+Cache::Handle* TwoQueueCache::Lookup(const Slice& key, uint32_t hash) {
+    Rcu::ReadLock lock(&rcu_);
+    LRUHandle* e = table_.Lookup(key, hash);
+    if (e == nullptr || e->Expired() || !e->TryRef()) {
+        return nullptr;
+    }
+    // Only entries in am_ use the bit, but checking the queue would race
+    // with the writer moving the entry.
+    if (!e->referenced.load(std::memory_order_relaxed)) {
+        e->referenced.store(true, std::memory_order_relaxed);
+    }
+    return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void TwoQueueCache::Release(Cache::Handle* handle) {
+    LRUHandle* e = reinterpret_cast<LRUHandle*>(handle);
+    if (Unref(e)) {
+        std::unique_lock<ShardMutex> l(mutex_);
+        Retire(e);
+        FreeRetired(&l, kRetireBatch);
+    }
+}
+
+Cache::Handle* TwoQueueCache::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value), Cache::Priority priority,
+    uint64_t expire_time) {
+
+    std::unique_lock<ShardMutex> l(mutex_);
+    if (!expiry_.Empty()) {
+        RemoveExpired(NowMillis());
+    }
+    const size_t limit = std::max(capacity_, usage_);
+
+    LRUHandle* e = NewLRUHandle(key, hash, value, charge, deleter, expire_time);
+
+    if (capacity_ > 0) {
+        e->refs++;  // for the cache's reference.
+        e->in_cache = true;
+        LRUHandle* old = table_.Insert(e);
+        // A key that is replaced or has a ghost is used more than once.
+        bool reused = (old != nullptr && old->queue == AM) ||
+                      a1out_hashes_.count(hash) > 0;
+        FinishErase(old);
+        Queue_Append(reused ? AM : A1IN, e);
+        expiry_.Add(e);
+        usage_ += charge;
+        entry_overhead_ += HandleMemory(e);
+    }  // else don't cache. (capacity_==0 is supported and turns off caching.)
+
+    size_t freed = 0;
+    EvictLocked(limit, SIZE_MAX, &freed);
+    EvictLocked(capacity_, kEvictBatch, &freed);
+    FreeRetired(&l, kRetireBatch);
+
+    return reinterpret_cast<Cache::Handle*>(e);
+}
+
+// Called with mutex_ held.
+size_t TwoQueueCache::EvictLocked(size_t target, size_t max_count, size_t* freed) {
+    size_t count = 0;
+    while (usage_ > target && count < max_count) {
+        LRUHandle* old = Victim();
+        if (old == nullptr) {
+            break;
+        }
+        if (old->queue == A1IN) {
+            Remember(old->hash, old->charge);
+        }
+        *freed += old->charge;
+        bool erased = FinishErase(table_.Remove(old->Key(), old->hash));
+        if (!erased) {  // to avoid unused variable when compiled NDEBUG
+            assert(erased);
+        }
+        count++;
+    }
+    return count;
+}
+
+// If e != nullptr, finish removing *e from the cache; it has already been
+// removed from the hash table.  Return whether e != nullptr.
+bool TwoQueueCache::FinishErase(LRUHandle* e) {
+    if (e != nullptr) {
+        assert(e->in_cache);
+        Queue_Remove(e);
+        expiry_.Remove(e);
+        e->in_cache = false;
+        usage_ -= e->charge;
+        entry_overhead_ -= HandleMemory(e);
+        if (Unref(e)) {
+            Retire(e);
+        }
+    }
+    return e != nullptr;
+}
+
+// Erases the entries expired at "now". Called with mutex_ held.
+void TwoQueueCache::RemoveExpired(uint64_t now) {
+    LRUHandle* e;
+    while ((e = expiry_.Expired(now)) != nullptr) {
+        bool erased = FinishErase(table_.Remove(e->Key(), e->hash));
+        if (!erased) {  // to avoid unused variable when compiled NDEBUG
+            assert(erased);
+        }
+    }
+}
+
+void TwoQueueCache::Erase(const Slice& key, uint32_t hash) {
+    std::unique_lock<ShardMutex> l(mutex_);
+    FinishErase(table_.Remove(key, hash));
+    FreeRetired(&l, kRetireBatch);
+}
+
+void TwoQueueCache::Prune() {
+    std::unique_lock<ShardMutex> l(mutex_);
+    for (LRUHandle* list : {&a1in_, &am_}) {
+        for (LRUHandle* e = list->next; e != list; ) {
+            LRUHandle* next = e->next;
+            if (e->refs.load(std::memory_order_relaxed) == 1) {
+                FinishErase(table_.Remove(e->Key(), e->hash));
+            }
+            e = next;
+        }
+    }
+    FreeRetired(&l, 1);
+}
+
+} // end anonymous namespace
+
+Cache* NewTwoQueueCache(size_t capacity) {
+    return NewTwoQueueCache(capacity, ShardedCache<TwoQueueCache>::kDefaultShardBits);
+}
+
+Cache* NewTwoQueueCache(size_t capacity, int num_shard_bits) {
+    return new ShardedCache<TwoQueueCache>(capacity, num_shard_bits);
+}
@@ -0,0 +1,20 @@
+#include "components/msg_dispatcher/actor.h"
+#include "components/msg_dispatcher/scheduler.h"
+
+void Actor::Put(Msg&& msg) {
+    if (ActorMetrics::Enabled() && ActorMetrics::Sample()) {
+        metrics_.msgs_in.fetch_add(ActorMetrics::kSampleRate, std::memory_order_relaxed);
+    }
+
+    Scheduler* scheduler = scheduler_.load(std::memory_order_acquire);
+    if (scheduler && scheduler->IsLocal(this)) {
+        local_mailbox_.push_back(msg.move());
+        scheduler->Notify(this);
+        return;
+    }
+
+    msg_queue_.Put(std::move(msg));
+    if (scheduler) {
+        scheduler->Notify(this);
+    }
+}
@@ -1,15 +1,27 @@
 #ifndef COMPONENTS_MSG_DISPATHCER_ACTOR_H_
 #define COMPONENTS_MSG_DISPATHCER_ACTOR_H_
 
+#include "components/msg_dispatcher/metrics.h"
 #include "components/msg_queue/msg.h"
 #include "components/msg_queue/msg_queue.h"
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <string>
 
 class Dispatcher;
+class Scheduler;
 
-class Actor {
+/*
+ * An Actor owns a mailbox and is addressed by name through a Dispatcher.
+ *
+ * An actor either drains its mailbox from a thread of its own in Handle(),
+ * or is run by a Scheduler, which calls Receive() once per message on a
+ * shared worker pool.
+ */
+class Actor : public std::enable_shared_from_this<Actor> {
 public:
     Actor(const Dispatcher* dispatcher, const std::string& name)
       : dispatcher_(dispatcher),
@@ -22,14 +34,51 @@ public:
 
     const std::string& Name() const { return name_; }
 
-    void Put(Msg&& msg) { msg_queue_.Put(std::move(msg)); }
+    // Handled counts and timings are only kept while a Scheduler runs the
+    // actor.
+    const ActorMetrics& Metrics() const { return metrics_; }
 
-    virtual void Handle() = 0;
+    // Messages waiting in the shared mailbox. Those posted from the worker
+    // of the actor's own shard are not counted.
+    uint64_t MailboxDepth() const { return msg_queue_.Size(); }
+
+    // Adds "msg" to the mailbox. Proxies for actors elsewhere override it
+    // to forward the message instead.
+    virtual void Put(Msg&& msg);
+
+    // Drains the mailbox on a dedicated thread.
+    virtual void Handle() {}
+
+    // Handles a single message when the actor is run by a Scheduler.
+    // Never called concurrently for the same actor.
+    virtual void Receive(Msg& msg) {}
 
 protected:
     const Dispatcher* dispatcher_ = nullptr;
     std::string name_;
     MsgQueue msg_queue_;
+
+private:
+    std::atomic<Scheduler*> scheduler_{nullptr};
+
+    // set while the actor is on a run queue or running on a worker
+    std::atomic<bool> scheduled_{false};
+
+    // Scheduler shard the actor runs on, and the one it is moving to.
+    std::atomic<size_t> shard_{0};
+    std::atomic<size_t> target_shard_{0};
+
+    // Messages posted from the worker of the actor's own shard. Only that
+    // worker touches it, so it needs no lock.
+    std::deque<std::unique_ptr<Msg>> local_mailbox_;
+
+    ActorMetrics metrics_;
+
+    // When the actor last became runnable, if that scheduling is sampled.
+    uint64_t scheduled_at_nanos_ = 0;
+
+    friend class Dispatcher;
+    friend class Scheduler;
 }; 
 
 #endif // COMPONENTS_MSG_DISPATHCER_ACTOR_H_
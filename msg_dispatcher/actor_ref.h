@@ -0,0 +1,34 @@
+#ifndef COMPONENTS_MSG_DISPATHCER_ACTOR_REF_H_
+#define COMPONENTS_MSG_DISPATHCER_ACTOR_REF_H_
+
+#include <memory>
+
+class Actor;
+
+/*
+ * ActorRef is a resolved actor address returned by Dispatcher::Register()
+ * and Dispatcher::Lookup(). Posting through it goes straight to the
+ * actor's mailbox without a name lookup. A default constructed ActorRef
+ * refers to no actor; posts through it are dropped.
+ */
+class ActorRef {
+public:
+    ActorRef() {}
+
+    bool Valid() const { return actor_ != nullptr; }
+
+    bool operator==(const ActorRef& other) const { return actor_ == other.actor_; }
+    bool operator!=(const ActorRef& other) const { return actor_ != other.actor_; }
+
+private:
+    explicit ActorRef(const std::shared_ptr<Actor>& actor)
+      : actor_(actor) {
+    }
+
+    std::shared_ptr<Actor> actor_;
+
+    friend class Dispatcher;
+
+}; // ActorRef
+
+#endif // COMPONENTS_MSG_DISPATHCER_ACTOR_REF_H_
@@ -1,17 +1,368 @@
 #include "components/msg_dispatcher/dispatcher.h"
 #include "components/msg_dispatcher/actor.h"
+#include "components/msg_dispatcher/scheduler.h"
+#include "components/util/hash.h"
 
 #include <algorithm>
 
-void Dispatcher::Register(std::shared_ptr<Actor> actor) {
+namespace {
+
+uint32_t HashName(const std::string& name) {
+    return Hash(name.data(), name.size(), 0);
+}
+
+}
+
+// Nodes are immutable once published except for "next", so readers can
+// walk a bucket while a writer links or unlinks other nodes.
+struct Dispatcher::Node {
+    Node(const std::string& n, uint32_t h, const std::shared_ptr<Actor>& a)
+      : name(n), hash(h), actor(a), next(nullptr) {
+    }
+
+    const std::string name;
+    const uint32_t hash;
+    const std::shared_ptr<Actor> actor;
+    std::atomic<Node*> next;
+};
+
+struct Dispatcher::Table {
+    explicit Table(uint32_t n)
+      : length(n), elems(0), buckets(new std::atomic<Node*>[n]) {
+        for (uint32_t i = 0; i < length; ++i) {
+            buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~Table() {
+        for (uint32_t i = 0; i < length; ++i) {
+            Node* node = buckets[i].load(std::memory_order_relaxed);
+            while (node != nullptr) {
+                Node* next = node->next.load(std::memory_order_relaxed);
+                delete node;
+                node = next;
+            }
+        }
+    }
+
+    std::atomic<Node*>& Bucket(uint32_t hash) { return buckets[hash & (length - 1)]; }
+
+    const uint32_t length;
+    uint32_t elems;     // only touched by writers
+    std::unique_ptr<std::atomic<Node*>[]> buckets;
+};
+
+Dispatcher::Dispatcher()
+  : table_(new Table(16)),
+    groups_(new GroupTable) {
+}
+
+Dispatcher::Dispatcher(size_t threads, size_t batch_size)
+  : table_(new Table(16)),
+    groups_(new GroupTable),
+    scheduler_(new Scheduler(threads, batch_size)) {
+}
+
+Dispatcher::~Dispatcher() {
+    // ActorRefs may keep actors alive past the dispatcher; a Put() through
+    // one must not find the scheduler once it is gone.
+    if (scheduler_) {
+        Table* table = table_.load();
+        for (uint32_t i = 0; i < table->length; ++i) {
+            for (Node* node = table->buckets[i].load(); node != nullptr; node = node->next.load()) {
+                scheduler_->Detach(node->actor.get());
+            }
+        }
+        for (const auto& group : *groups_.load()) {
+            for (const std::shared_ptr<Actor>& member : *group.second) {
+                scheduler_->Detach(member.get());
+            }
+        }
+    }
+    scheduler_.reset();
+    delete groups_.load();
+    delete table_.load();
+}
+
+Dispatcher::Node* Dispatcher::Find(const Table* table,
+                                   const std::string& actor_name,
+                                   uint32_t hash) const {
+    Node* node = const_cast<Table*>(table)->Bucket(hash).load();
+    while (node != nullptr && (node->hash != hash || node->name != actor_name)) {
+        node = node->next.load();
+    }
+    return node;
+}
+
+// Requires write_mutex_. The caller frees the returned node after
+// rcu_.Synchronize().
+Dispatcher::Node* Dispatcher::Unlink(Table* table,
+                                     const std::string& actor_name,
+                                     uint32_t hash) {
+    std::atomic<Node*>* ptr = &table->Bucket(hash);
+    Node* node = ptr->load();
+    while (node != nullptr && (node->hash != hash || node->name != actor_name)) {
+        ptr = &node->next;
+        node = ptr->load();
+    }
+    if (node != nullptr) {
+        ptr->store(node->next.load());
+        --table->elems;
+    }
+    return node;
+}
+
+// Requires write_mutex_. Readers may still be walking the old table, so
+// the new one gets its own copies of the nodes.
+void Dispatcher::Resize() {
+    Table* old_table = table_.load();
+    Table* new_table = new Table(old_table->length * 2);
+    for (uint32_t i = 0; i < old_table->length; ++i) {
+        for (Node* node = old_table->buckets[i].load(); node != nullptr; node = node->next.load()) {
+            Node* copy = new Node(node->name, node->hash, node->actor);
+            std::atomic<Node*>& bucket = new_table->Bucket(copy->hash);
+            copy->next.store(bucket.load());
+            bucket.store(copy);
+            ++new_table->elems;
+        }
+    }
+    table_.store(new_table);
+    rcu_.Synchronize();
+    delete old_table;
+}
+
+ActorRef Dispatcher::Register(std::shared_ptr<Actor> actor) {
     if (actor.get()) {
-        actors_[actor->Name()] = actor;
+        const uint32_t hash = HashName(actor->Name());
+        Node* old = nullptr;
+        bool replaced = false;     // "old" holds another actor
+
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            Table* table = table_.load();
+            old = Unlink(table, actor->Name(), hash);
+
+            Node* node = new Node(actor->Name(), hash, actor);
+            std::atomic<Node*>& bucket = table->Bucket(hash);
+            node->next.store(bucket.load());
+            bucket.store(node);
+            if (++table->elems > table->length) {
+                Resize();
+            }
+
+            // Registering an actor again keeps it where it runs.
+            replaced = old != nullptr && old->actor != actor;
+            if (scheduler_ && (old == nullptr || replaced)) {
+                scheduler_->Attach(actor.get());
+            }
+            if (replaced) {
+                LeaveAllGroups(old->actor);
+            }
+        }
+
+        if (old != nullptr) {
+            if (scheduler_ && replaced) {
+                scheduler_->Detach(old->actor.get());
+            }
+            rcu_.Synchronize();
+            delete old;
+        }
+    }
+    return ActorRef(actor);
+}
+
+void Dispatcher::Unregister(const std::string& actor_name) {
+    Node* old = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        old = Unlink(table_.load(), actor_name, HashName(actor_name));
+        if (old != nullptr) {
+            LeaveAllGroups(old->actor);
+        }
+    }
+
+    if (old != nullptr) {
+        if (scheduler_) {
+            scheduler_->Detach(old->actor.get());
+        }
+        rcu_.Synchronize();
+        delete old;
+    }
+}
+
+ActorRef Dispatcher::Lookup(const std::string& actor_name) const {
+    Rcu::ReadLock lock(&rcu_);
+    Node* node = Find(table_.load(), actor_name, HashName(actor_name));
+    if (node != nullptr) {
+        return ActorRef(node->actor);
+    }
+    return ActorRef();
+}
+
+// Attributes a post made from inside Actor::Receive() to that actor.
+void Dispatcher::CountPost() {
+    if (!ActorMetrics::Enabled()) {
+        return;
+    }
+    Actor* sender = Scheduler::CurrentActor();
+    if (sender != nullptr) {
+        // Only this worker writes msgs_out while the sender runs.
+        uint64_t out = sender->metrics_.msgs_out.load(std::memory_order_relaxed);
+        sender->metrics_.msgs_out.store(out + 1, std::memory_order_relaxed);
     }
 }
 
 void Dispatcher::Post(const std::string& actor_name, Msg&& msg) const {
-    auto it = actors_.find(actor_name);
-    if (it != actors_.end()) {
-        it->second->Put(std::move(msg));
+    CountPost();
+    Rcu::ReadLock lock(&rcu_);
+    Node* node = Find(table_.load(), actor_name, HashName(actor_name));
+    if (node != nullptr) {
+        node->actor->Put(std::move(msg));
+    }
+}
+
+void Dispatcher::Post(const ActorRef& actor, Msg&& msg) const {
+    CountPost();
+    if (actor.actor_) {
+        actor.actor_->Put(std::move(msg));
+    }
+}
+
+void Dispatcher::PublishGroups(GroupTable* groups) {
+    const GroupTable* old = groups_.load();
+    groups_.store(groups);
+    rcu_.Synchronize();
+    delete old;
+}
+
+void Dispatcher::LeaveAllGroups(const std::shared_ptr<Actor>& actor) {
+    GroupTable* groups = nullptr;
+    for (const auto& group : *groups_.load()) {
+        const Members& members = *group.second;
+        if (std::find(members.begin(), members.end(), actor) == members.end()) {
+            continue;
+        }
+        if (groups == nullptr) {
+            groups = new GroupTable(*groups_.load());
+        }
+        if (members.size() == 1) {
+            groups->erase(group.first);
+        } else {
+            Members* updated = new Members(members);
+            updated->erase(std::remove(updated->begin(), updated->end(), actor), updated->end());
+            (*groups)[group.first].reset(updated);
+        }
+    }
+    if (groups != nullptr) {
+        PublishGroups(groups);
+    }
+}
+
+void Dispatcher::JoinGroup(const std::string& group, const ActorRef& actor) {
+    JoinGroup(group, std::vector<ActorRef>(1, actor));
+}
+
+void Dispatcher::JoinGroup(const std::string& group, const std::vector<ActorRef>& actors) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    GroupTable* groups = new GroupTable(*groups_.load());
+    auto& members = (*groups)[group];
+    Members* updated = members ? new Members(*members) : new Members;
+    for (const ActorRef& actor : actors) {
+        if (actor.actor_ &&
+            std::find(updated->begin(), updated->end(), actor.actor_) == updated->end()) {
+            updated->push_back(actor.actor_);
+        }
+    }
+    members.reset(updated);
+    PublishGroups(groups);
+}
+
+void Dispatcher::LeaveGroup(const std::string& group, const ActorRef& actor) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    auto it = groups_.load()->find(group);
+    if (it == groups_.load()->end()) {
+        return;
+    }
+
+    Members* updated = new Members(*it->second);
+    updated->erase(std::remove(updated->begin(), updated->end(), actor.actor_), updated->end());
+    GroupTable* groups = new GroupTable(*groups_.load());
+    if (updated->empty()) {
+        delete updated;
+        groups->erase(group);
+    } else {
+        (*groups)[group].reset(updated);
+    }
+    PublishGroups(groups);
+}
+
+bool Dispatcher::Broadcast(const std::string& group, Msg&& msg) const {
+    Rcu::ReadLock lock(&rcu_);
+    const GroupTable* groups = groups_.load();
+    auto it = groups->find(group);
+    if (it == groups->end()) {
+        return true;
+    }
+
+    Scheduler::Batch batch(scheduler_.get());
+    for (const std::shared_ptr<Actor>& member : *it->second) {
+        std::unique_ptr<Msg> copy = msg.Share();
+        if (!copy) {
+            return false;
+        }
+        CountPost();
+        member->Put(std::move(*copy));
+    }
+    return true;
+}
+
+std::vector<ActorStats> Dispatcher::TopActors(size_t n, ActorStats::Order order) const {
+    std::vector<ActorStats> stats;
+    {
+        Rcu::ReadLock lock(&rcu_);
+        Table* table = table_.load();
+        for (uint32_t i = 0; i < table->length; ++i) {
+            for (Node* node = table->buckets[i].load(); node != nullptr; node = node->next.load()) {
+                const ActorMetrics& metrics = node->actor->Metrics();
+                ActorStats s;
+                s.name = node->name;
+                s.msgs_in = metrics.msgs_in.load(std::memory_order_relaxed);
+                s.msgs_out = metrics.msgs_out.load(std::memory_order_relaxed);
+                s.mailbox_depth = node->actor->MailboxDepth();
+                const ActorMetrics::Timings* timings = metrics.GetTimings();
+                s.handle_p50_nanos = timings ? timings->handle_nanos.Percentile(50) : 0;
+                s.handle_p99_nanos = timings ? timings->handle_nanos.Percentile(99) : 0;
+                s.wait_p99_nanos = timings ? timings->wait_nanos.Percentile(99) : 0;
+                stats.push_back(s);
+            }
+        }
+    }
+
+    auto worse = [order](const ActorStats& a, const ActorStats& b) {
+        if (order == ActorStats::DEEPEST) {
+            return a.mailbox_depth > b.mailbox_depth;
+        }
+        return a.handle_p99_nanos > b.handle_p99_nanos;
+    };
+    n = std::min(n, stats.size());
+    std::partial_sort(stats.begin(), stats.begin() + n, stats.end(), worse);
+    stats.resize(n);
+    return stats;
+}
+
+size_t Dispatcher::Shards() const {
+    return scheduler_ ? scheduler_->Shards() : 0;
+}
+
+void Dispatcher::Migrate(const ActorRef& actor, size_t shard) {
+    if (scheduler_ && actor.actor_) {
+        scheduler_->Migrate(actor.actor_.get(), shard);
+    }
+}
+
+void Dispatcher::Colocate(const ActorRef& actor, const ActorRef& peer) {
+    if (scheduler_ && actor.actor_ && peer.actor_) {
+        scheduler_->Migrate(actor.actor_.get(), scheduler_->ShardOf(peer.actor_.get()));
     }
 }
@@ -1,25 +1,124 @@
 #ifndef COMPONENTS_MSG_DISPATHCER_DISPATCHER_H_
 #define COMPONENTS_MSG_DISPATHCER_DISPATCHER_H_
 
+#include "components/msg_dispatcher/actor_ref.h"
+#include "components/msg_dispatcher/metrics.h"
 #include "components/msg_queue/msg.h"
+#include "components/util/rcu.h"
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 class Actor;
+class Scheduler;
 
+/*
+ * Dispatcher maps actor names to actors.
+ *
+ * All methods are thread-safe. Lookup() and Post() never take a lock:
+ * they read the name table under RCU, while Register() and Unregister()
+ * serialize on a mutex and free replaced entries only after concurrent
+ * readers are done with them.
+ */
 class Dispatcher {
 public:
-    void Register(std::shared_ptr<Actor> actor);
+    Dispatcher();
+
+    // Actors registered with this dispatcher are run on "threads" shared
+    // workers, each handling up to "batch_size" messages per turn. Each
+    // worker is a shard pinned to its own core.
+    Dispatcher(size_t threads, size_t batch_size);
+
+    ~Dispatcher();
+
+    // Returns a handle for posting to "actor" without a name lookup.
+    // A different actor already registered under the same name is
+    // replaced, as if unregistered; registering the same actor again
+    // changes nothing.
+    ActorRef Register(std::shared_ptr<Actor> actor);
+
+    // Removes the actor registered under "actor_name" and takes it out of
+    // all groups. ActorRefs to it stay valid, but the dispatcher no longer
+    // runs it.
+    void Unregister(const std::string& actor_name);
+
+    // Returns the actor registered under "actor_name", or an invalid ref.
+    ActorRef Lookup(const std::string& actor_name) const;
 
     void Post(const std::string& actor_name, Msg&& msg) const;
 
+    void Post(const ActorRef& actor, Msg&& msg) const;
+
+    // Adds "actor" to the named group, creating the group if needed.
+    // Membership changes copy the group's member list; add many actors
+    // with one call.
+    void JoinGroup(const std::string& group, const ActorRef& actor);
+    void JoinGroup(const std::string& group, const std::vector<ActorRef>& actors);
+
+    // Removes "actor" from the named group.
+    void LeaveGroup(const std::string& group, const ActorRef& actor);
+
+    // Posts "msg" to every member of "group". Each member gets msg.Share(),
+    // so a SharedMsg payload is shared rather than copied, and members are
+    // made runnable in one batch per scheduler shard. Returns false if
+    // "msg" cannot be shared.
+    bool Broadcast(const std::string& group, Msg&& msg) const;
+
+    // Metrics of the "n" registered actors that are slowest to handle a
+    // message (p99) or have the deepest mailboxes, worst first. All but
+    // the mailbox depth need ActorMetrics::SetEnabled(true).
+    std::vector<ActorStats> TopActors(size_t n, ActorStats::Order order) const;
+
+    // Number of scheduler shards, 0 if actors run on their own threads.
+    size_t Shards() const;
+
+    // Move "actor" to scheduler shard "shard".
+    void Migrate(const ActorRef& actor, size_t shard);
+
+    // Move "actor" to the shard "peer" runs on, so that messages between
+    // the two skip the locked mailbox.
+    void Colocate(const ActorRef& actor, const ActorRef& peer);
+
 private:
-    std::map<std::string, std::shared_ptr<Actor>> actors_;
+    struct Node;
+    struct Table;
+
+    using Members = std::vector<std::shared_ptr<Actor>>;
+    using GroupTable = std::map<std::string, std::shared_ptr<const Members>>;
+
+    // Publishes "groups" and frees the table it replaces. Requires
+    // write_mutex_.
+    void PublishGroups(GroupTable* groups);
+
+    // Removes "actor" from every group. Requires write_mutex_.
+    void LeaveAllGroups(const std::shared_ptr<Actor>& actor);
+
+    static void CountPost();
+
+    Node* Find(const Table* table, const std::string& actor_name, uint32_t hash) const;
+    Node* Unlink(Table* table, const std::string& actor_name, uint32_t hash);
+    void Resize();
+
+    // Name table, replaced as a whole when it grows.
+    std::atomic<Table*> table_;
+
+    // Group name to members, replaced as a whole on every change.
+    std::atomic<const GroupTable*> groups_;
+
+    // Guards writers of table_ and groups_.
+    std::mutex write_mutex_;
+
+    mutable Rcu rcu_;
+
+    // Reset first in ~Dispatcher() so that workers are joined before any
+    // actor is destroyed.
+    std::unique_ptr<Scheduler> scheduler_;
 
 }; 
 
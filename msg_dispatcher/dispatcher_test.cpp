@@ -5,10 +5,13 @@
 #include "thirdparty/glog/logging.h"
 #include "thirdparty/gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 const int MSG_FOO = 1, MSG_BAR = 2;
 
@@ -90,3 +93,479 @@ TEST_F(DispatcherTest, Test) {
     DispatcherTest::dispatcher->Post("DemoActor", DataMsg<DemoMsg>(MSG_FOO, dm));
     dh->Handle();
 }
+
+class CountingActor : public Actor {
+public:
+    CountingActor(const Dispatcher* dispatcher, const std::string& name,
+                  std::atomic<int>* total)
+      : Actor(dispatcher, name),
+        total_(total) {
+    }
+
+    virtual void Receive(Msg& msg) override {
+        // Scheduler never runs the same actor on two workers at once.
+        EXPECT_FALSE(running_.exchange(true));
+        EXPECT_EQ(msg.GetMsgId(), expected_id_);
+        ++expected_id_;
+        running_.store(false);
+        total_->fetch_add(1);
+    }
+
+private:
+    std::atomic<int>* total_;
+    std::atomic<bool> running_{false};
+    int expected_id_ = 0;
+};
+
+TEST(Scheduler, ManyActorsFewThreads) {
+    const int kActors = 10000;
+    const int kMsgs = 20;
+    std::atomic<int> total(0);
+
+    Dispatcher dispatcher(4, 8);
+    std::vector<ActorRef> refs;
+    for (int i = 0; i < kActors; ++i) {
+        refs.push_back(dispatcher.Register(std::make_shared<CountingActor>(
+            &dispatcher, "actor" + std::to_string(i), &total)));
+    }
+
+    for (int m = 0; m < kMsgs; ++m) {
+        for (auto& ref : refs) {
+            dispatcher.Post(ref, Msg(m));
+        }
+    }
+
+    for (int i = 0; i < 1000 && total.load() < kActors * kMsgs; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(total.load(), kActors * kMsgs);
+}
+
+TEST(Dispatcher, ActorRef) {
+    std::atomic<int> total(0);
+    Dispatcher dispatcher(1, 8);
+
+    ActorRef ref = dispatcher.Register(
+        std::make_shared<CountingActor>(&dispatcher, "counter", &total));
+    EXPECT_TRUE(ref.Valid());
+    EXPECT_TRUE(ref == dispatcher.Lookup("counter"));
+    EXPECT_FALSE(dispatcher.Lookup("missing").Valid());
+
+    dispatcher.Post(ref, Msg(0));
+    dispatcher.Post("counter", Msg(1));
+    dispatcher.Post(dispatcher.Lookup("counter"), Msg(2));
+    dispatcher.Post(ActorRef(), Msg(3));
+
+    for (int i = 0; i < 1000 && total.load() < 3; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(total.load(), 3);
+}
+
+TEST(Dispatcher, RegisterTwice) {
+    std::atomic<int> total(0);
+    Dispatcher dispatcher(2, 8);
+    auto actor = std::make_shared<CountingActor>(&dispatcher, "counter", &total);
+
+    ActorRef ref = dispatcher.Register(actor);
+    EXPECT_TRUE(ref == dispatcher.Register(actor));
+    dispatcher.Post(ref, Msg(0));
+    dispatcher.Post("counter", Msg(1));
+
+    for (int i = 0; i < 1000 && total.load() < 2; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(total.load(), 2);
+}
+
+TEST(Dispatcher, UnregisterLeavesGroups) {
+    std::atomic<int> total(0);
+    Dispatcher dispatcher(2, 8);
+    ActorRef stays = dispatcher.Register(
+        std::make_shared<CountingActor>(&dispatcher, "stays", &total));
+    auto leaving = std::make_shared<CountingActor>(&dispatcher, "leaves", &total);
+    dispatcher.JoinGroup("all", {stays, dispatcher.Register(leaving)});
+    dispatcher.JoinGroup("alone", dispatcher.Lookup("leaves"));
+
+    dispatcher.Unregister("leaves");
+    EXPECT_TRUE(dispatcher.Broadcast("all", Msg(0)));
+    EXPECT_TRUE(dispatcher.Broadcast("alone", Msg(0)));
+
+    for (int i = 0; i < 1000 && total.load() < 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(total.load(), 1);
+    EXPECT_EQ(leaving->Metrics().msgs_in.load(), 0u);
+}
+
+TEST(Dispatcher, ActorsOutliveDispatcher) {
+    std::atomic<int> total(0);
+    std::shared_ptr<Actor> actor;
+    std::shared_ptr<Actor> member;
+    {
+        Dispatcher dispatcher(2, 8);
+        actor = std::make_shared<CountingActor>(&dispatcher, "counter", &total);
+        member = std::make_shared<CountingActor>(&dispatcher, "member", &total);
+        ActorRef ref = dispatcher.Register(actor);
+        dispatcher.JoinGroup("group", dispatcher.Register(member));
+    }
+
+    // Messages go to the mailbox, with no scheduler left to run them.
+    actor->Put(Msg(0));
+    member->Put(Msg(0));
+    EXPECT_EQ(total.load(), 0);
+    EXPECT_EQ(actor->MailboxDepth(), 1u);
+}
+
+// Posting by name from several threads while actors come and go.
+TEST(Dispatcher, ConcurrentRegister) {
+    const int kStable = 100;
+    const int kPosters = 4;
+    const int kRounds = 20000;
+    std::atomic<int> total(0);
+    std::atomic<bool> done(false);
+
+    Dispatcher dispatcher(2, 16);
+    for (int i = 0; i < kStable; ++i) {
+        dispatcher.Register(std::make_shared<CountingActor>(
+            &dispatcher, "stable" + std::to_string(i), &total));
+    }
+
+    std::thread churn([&] {
+        for (int i = 0; !done.load(); ++i) {
+            std::string name = "churn" + std::to_string(i % 1000);
+            dispatcher.Register(std::make_shared<Actor>(&dispatcher, name));
+            dispatcher.Unregister("churn" + std::to_string((i + 500) % 1000));
+        }
+    });
+
+    std::vector<std::thread> posters;
+    for (int t = 0; t < kPosters; ++t) {
+        posters.emplace_back([&, t] {
+            std::vector<int> next_id(kStable, 0);
+            for (int i = 0; i < kRounds; ++i) {
+                // Each actor expects ordered ids, so every poster owns a
+                // disjoint set of stable actors.
+                int a = (i * kPosters + t) % kStable;
+                dispatcher.Post("stable" + std::to_string(a), Msg(next_id[a]++));
+                dispatcher.Post("churn" + std::to_string(i % 1000), Msg(0));
+            }
+        });
+    }
+
+    for (auto& poster : posters) {
+        poster.join();
+    }
+    done.store(true);
+    churn.join();
+
+    for (int i = 0; i < 1000 && total.load() < kPosters * kRounds; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(total.load(), kPosters * kRounds);
+}
+
+// Sends "count" ordered messages to its peer for every message it receives.
+class ProducerActor : public Actor {
+public:
+    ProducerActor(const Dispatcher* dispatcher, const std::string& name, int count)
+      : Actor(dispatcher, name),
+        count_(count) {
+    }
+
+    void SetPeer(const ActorRef& peer) { peer_ = peer; }
+
+    virtual void Receive(Msg& msg) override {
+        for (int i = 0; i < count_; ++i) {
+            dispatcher_->Post(peer_, Msg(next_id_++));
+        }
+    }
+
+private:
+    ActorRef peer_;
+    int count_;
+    int next_id_ = 0;
+};
+
+class PingPongActor : public Actor {
+public:
+    PingPongActor(const Dispatcher* dispatcher, const std::string& name,
+                  int rounds, std::atomic<int>* done)
+      : Actor(dispatcher, name),
+        rounds_(rounds),
+        done_(done) {
+    }
+
+    void SetPeer(const ActorRef& peer) { peer_ = peer; }
+
+    virtual void Receive(Msg& msg) override {
+        if (msg.GetMsgId() < rounds_) {
+            dispatcher_->Post(peer_, Msg(msg.GetMsgId() + 1));
+        } else {
+            done_->fetch_add(1);
+        }
+    }
+
+private:
+    ActorRef peer_;
+    int rounds_;
+    std::atomic<int>* done_;
+};
+
+TEST(Scheduler, LocalPingPong) {
+    const int kRounds = 100000;
+    std::atomic<int> done(0);
+
+    Dispatcher dispatcher(2, 16);
+    auto ping = std::make_shared<PingPongActor>(&dispatcher, "ping", kRounds, &done);
+    auto pong = std::make_shared<PingPongActor>(&dispatcher, "pong", kRounds, &done);
+    ActorRef ping_ref = dispatcher.Register(ping);
+    ActorRef pong_ref = dispatcher.Register(pong);
+    ping->SetPeer(pong_ref);
+    pong->SetPeer(ping_ref);
+    dispatcher.Colocate(pong_ref, ping_ref);
+
+    dispatcher.Post(ping_ref, Msg(0));
+
+    for (int i = 0; i < 1000 && done.load() < 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(done.load(), 1);
+}
+
+// Messages from one sender stay in order while the receiver moves between
+// the sender's shard and others.
+TEST(Scheduler, MigrateKeepsOrder) {
+    const int kBursts = 200;
+    const int kBurst = 100;
+    std::atomic<int> total(0);
+
+    Dispatcher dispatcher(3, 8);
+    auto producer = std::make_shared<ProducerActor>(&dispatcher, "producer", kBurst);
+    ActorRef producer_ref = dispatcher.Register(producer);
+    ActorRef counter_ref = dispatcher.Register(
+        std::make_shared<CountingActor>(&dispatcher, "counter", &total));
+    producer->SetPeer(counter_ref);
+
+    for (int i = 0; i < kBursts; ++i) {
+        dispatcher.Post(producer_ref, Msg(0));
+        if (i % 2 == 0) {
+            dispatcher.Colocate(counter_ref, producer_ref);
+        } else {
+            dispatcher.Migrate(counter_ref, i);
+        }
+    }
+
+    for (int i = 0; i < 1000 && total.load() < kBursts * kBurst; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(total.load(), kBursts * kBurst);
+}
+
+// Posts "burst" messages to itself on message 0, which go to its local
+// mailbox, then waits for "release".
+class SelfPostingActor : public Actor {
+public:
+    SelfPostingActor(const Dispatcher* dispatcher, const std::string& name, int burst)
+      : Actor(dispatcher, name),
+        burst_(burst) {
+    }
+
+    virtual void Receive(Msg& msg) override {
+        if (msg.GetMsgId() == 0) {
+            for (int i = 1; i <= burst_; ++i) {
+                dispatcher_->Post(Name(), Msg(i));
+            }
+            posted.store(true);
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+        }
+        received.fetch_add(1);
+    }
+
+    std::atomic<bool> posted{false};
+    std::atomic<bool> release{false};
+    std::atomic<int> received{0};
+
+private:
+    int burst_;
+};
+
+// Local messages left when an actor is unregistered are run once it is
+// registered again.
+TEST(Scheduler, ReattachRunsLocalMessages) {
+    const int kBurst = 10;
+
+    Dispatcher dispatcher(1, 1);
+    auto actor = std::make_shared<SelfPostingActor>(&dispatcher, "self", kBurst);
+    dispatcher.Register(actor);
+    dispatcher.Post("self", Msg(0));
+    while (!actor->posted.load()) {
+        std::this_thread::yield();
+    }
+    dispatcher.Unregister("self");
+    actor->release.store(true);
+
+    for (int i = 0; i < 100 && actor->received.load() < 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(actor->received.load(), 1);
+
+    dispatcher.Register(actor);
+    for (int i = 0; i < 1000 && actor->received.load() < kBurst + 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(actor->received.load(), kBurst + 1);
+}
+
+class SlowActor : public Actor {
+public:
+    SlowActor(const Dispatcher* dispatcher, const std::string& name)
+      : Actor(dispatcher, name) {
+    }
+
+    virtual void Receive(Msg& msg) override {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+};
+
+TEST(Metrics, SlowestActor) {
+    const int kMsgs = 64;
+    std::atomic<int> total(0);
+    ActorMetrics::SetEnabled(true);
+
+    Dispatcher dispatcher(2, 8);
+    auto slow = std::make_shared<SlowActor>(&dispatcher, "slow");
+    auto fast = std::make_shared<CountingActor>(&dispatcher, "fast", &total);
+    auto producer = std::make_shared<ProducerActor>(&dispatcher, "producer", kMsgs);
+    ActorRef slow_ref = dispatcher.Register(slow);
+    ActorRef fast_ref = dispatcher.Register(fast);
+    ActorRef producer_ref = dispatcher.Register(producer);
+    producer->SetPeer(fast_ref);
+
+    dispatcher.Post(producer_ref, Msg(0));
+    for (int i = 0; i < kMsgs; ++i) {
+        dispatcher.Post(slow_ref, Msg(i));
+    }
+
+    for (int i = 0; i < 1000 && (total.load() < kMsgs ||
+                                 slow->Metrics().msgs_handled.load() < kMsgs); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    EXPECT_EQ(producer->Metrics().msgs_out.load(), uint64_t(kMsgs));
+    EXPECT_EQ(fast->Metrics().msgs_handled.load(), uint64_t(kMsgs));
+    EXPECT_EQ(fast->MailboxDepth(), 0u);
+    ASSERT_NE(slow->Metrics().GetTimings(), nullptr);
+    EXPECT_EQ(slow->Metrics().GetTimings()->handle_nanos.Count(),
+              uint64_t(kMsgs / ActorMetrics::kSampleRate));
+
+    auto top = dispatcher.TopActors(1, ActorStats::SLOWEST);
+    ASSERT_EQ(top.size(), 1u);
+    EXPECT_EQ(top[0].name, "slow");
+    EXPECT_GE(top[0].handle_p99_nanos, 500000u);
+    std::cout << FormatActorStats(dispatcher.TopActors(3, ActorStats::SLOWEST));
+    ActorMetrics::SetEnabled(false);
+}
+
+TEST(Metrics, SampledPuts) {
+    const uint64_t kMsgs = 16000;
+    ActorMetrics::SetEnabled(true);
+
+    Dispatcher dispatcher;
+    auto actor = std::make_shared<Actor>(&dispatcher, "idle");
+    dispatcher.Register(actor);
+    for (uint64_t i = 0; i < kMsgs; ++i) {
+        dispatcher.Post("idle", Msg(0));
+    }
+
+    // msgs_in is an estimate; the mailbox depth is exact.
+    uint64_t in = actor->Metrics().msgs_in.load();
+    EXPECT_EQ(in % ActorMetrics::kSampleRate, 0u);
+    EXPECT_GE(in, kMsgs * 8 / 10);
+    EXPECT_LE(in, kMsgs * 12 / 10);
+    EXPECT_EQ(actor->MailboxDepth(), kMsgs);
+
+    // An actor that never ran has no histograms.
+    EXPECT_EQ(actor->Metrics().GetTimings(), nullptr);
+    ActorMetrics::SetEnabled(false);
+}
+
+TEST(Metrics, DeepestMailbox) {
+    Dispatcher dispatcher;
+    dispatcher.Register(std::make_shared<Actor>(&dispatcher, "a"));
+    dispatcher.Register(std::make_shared<Actor>(&dispatcher, "b"));
+    for (int i = 0; i < 5; ++i) {
+        dispatcher.Post("a", Msg(i));
+    }
+    dispatcher.Post("b", Msg(0));
+
+    std::atomic<int> reports(0);
+    {
+        MetricsReporter reporter(&dispatcher, 1, 1, ActorStats::DEEPEST,
+                                 [&reports](const std::vector<ActorStats>& top) {
+                                     ASSERT_EQ(top.size(), 1u);
+                                     EXPECT_EQ(top[0].name, "a");
+                                     EXPECT_EQ(top[0].mailbox_depth, 5u);
+                                     reports.fetch_add(1);
+                                 });
+        for (int i = 0; i < 1000 && reports.load() < 2; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    EXPECT_GE(reports.load(), 2);
+}
+
+class SubscriberActor : public Actor {
+public:
+    SubscriberActor(const Dispatcher* dispatcher, const std::string& name,
+                    std::atomic<int>* total, const std::string** seen)
+      : Actor(dispatcher, name),
+        total_(total),
+        seen_(seen) {
+    }
+
+    virtual void Receive(Msg& msg) override {
+        auto& shared = dynamic_cast<SharedMsg<std::string>&>(msg);
+        // Every member sees the very same payload object.
+        EXPECT_EQ(&shared.GetPayload(), *seen_);
+        total_->fetch_add(1);
+    }
+
+private:
+    std::atomic<int>* total_;
+    const std::string** seen_;
+};
+
+TEST(Dispatcher, Broadcast) {
+    const int kMembers = 1000;
+    std::atomic<int> total(0);
+    const std::string* seen = nullptr;
+
+    Dispatcher dispatcher(4, 16);
+    std::vector<ActorRef> members;
+    for (int i = 0; i < kMembers; ++i) {
+        members.push_back(dispatcher.Register(std::make_shared<SubscriberActor>(
+            &dispatcher, "member" + std::to_string(i), &total, &seen)));
+    }
+    dispatcher.JoinGroup("all", members);
+    dispatcher.JoinGroup("all", members[0]);
+    dispatcher.JoinGroup("first", members[0]);
+
+    auto payload = std::make_shared<const std::string>("event");
+    seen = payload.get();
+    EXPECT_TRUE(dispatcher.Broadcast("all", SharedMsg<std::string>(MSG_FOO, payload)));
+    EXPECT_TRUE(dispatcher.Broadcast("none", SharedMsg<std::string>(MSG_FOO, payload)));
+    EXPECT_FALSE(dispatcher.Broadcast("first", DataMsg<std::string>(MSG_FOO, "owned")));
+
+    dispatcher.LeaveGroup("all", members[1]);
+    dispatcher.LeaveGroup("first", members[0]);
+    EXPECT_TRUE(dispatcher.Broadcast("all", SharedMsg<std::string>(MSG_BAR, payload)));
+    EXPECT_TRUE(dispatcher.Broadcast("first", DataMsg<std::string>(MSG_FOO, "owned")));
+
+    for (int i = 0; i < 1000 && total.load() < 2 * kMembers - 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(total.load(), 2 * kMembers - 1);
+}
@@ -0,0 +1,98 @@
+#include "components/msg_dispatcher/metrics.h"
+#include "components/msg_dispatcher/dispatcher.h"
+
+#include <chrono>
+#include <stdio.h>
+
+std::atomic<bool> ActorMetrics::enabled_(false);
+
+uint32_t ActorMetrics::SampleSeed() {
+    static std::atomic<uint32_t> next(0);
+    // Distinct and never zero, which would keep xorshift at zero.
+    return (next.fetch_add(1) + 1) * 2654435761u | 1;
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (int i = 0; i < kBuckets; ++i) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::Count() const {
+    uint64_t count = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        count += buckets_[i].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+    uint64_t counts[kBuckets];
+    uint64_t total = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    double threshold = total * (p / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += counts[i];
+        if (seen > 0 && seen >= threshold) {
+            return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+        }
+    }
+    return (uint64_t(1) << (kBuckets - 1)) - 1;
+}
+
+std::string FormatActorStats(const std::vector<ActorStats>& stats) {
+    std::string result;
+    char buf[256];
+    for (const ActorStats& s : stats) {
+        snprintf(buf, sizeof(buf),
+                 "%s: in=%llu out=%llu depth=%llu handle_p50=%lluns handle_p99=%lluns wait_p99=%lluns\n",
+                 s.name.c_str(),
+                 static_cast<unsigned long long>(s.msgs_in),
+                 static_cast<unsigned long long>(s.msgs_out),
+                 static_cast<unsigned long long>(s.mailbox_depth),
+                 static_cast<unsigned long long>(s.handle_p50_nanos),
+                 static_cast<unsigned long long>(s.handle_p99_nanos),
+                 static_cast<unsigned long long>(s.wait_p99_nanos));
+        result.append(buf);
+    }
+    return result;
+}
+
+MetricsReporter::MetricsReporter(const Dispatcher* dispatcher, uint32_t interval_ms,
+                                 size_t top_n, ActorStats::Order order, Sink sink)
+  : dispatcher_(dispatcher),
+    interval_ms_(interval_ms > 0 ? interval_ms : 1),
+    top_n_(top_n),
+    order_(order),
+    sink_(sink),
+    stop_(false) {
+    thread_ = std::thread([this] { Loop(); });
+}
+
+MetricsReporter::~MetricsReporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    cond_.notify_all();
+    thread_.join();
+}
+
+void MetricsReporter::Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cond_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                           [this] { return stop_; })) {
+        lock.unlock();
+        sink_(dispatcher_->TopActors(top_n_, order_));
+        lock.lock();
+    }
+}
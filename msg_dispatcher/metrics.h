@@ -0,0 +1,169 @@
+#ifndef COMPONENTS_MSG_DISPATHCER_METRICS_H_
+#define COMPONENTS_MSG_DISPATHCER_METRICS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Dispatcher;
+
+/*
+ * Histogram of durations in nanoseconds with one bucket per power of two.
+ * Add() is a single relaxed increment and may be called from any thread.
+ */
+class LatencyHistogram {
+public:
+    static const int kBuckets = 48;
+
+    LatencyHistogram();
+
+    void Add(uint64_t nanos) {
+        int bucket = nanos == 0 ? 0 : 64 - __builtin_clzll(nanos);
+        if (bucket >= kBuckets) {
+            bucket = kBuckets - 1;
+        }
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const;
+
+    // Upper bound of the bucket holding the "p"-th percentile, 0 <= p <= 100.
+    uint64_t Percentile(double p) const;
+
+private:
+    // bucket i counts values in [2^(i-1), 2^i)
+    std::atomic<uint64_t> buckets_[kBuckets];
+};
+
+/*
+ * Counters kept by every Actor. Only the worker running an actor writes
+ * its msgs_out and msgs_handled. Senders write msgs_in, so it is sampled:
+ * each Put adds kSampleRate with probability 1/kSampleRate, drawn per
+ * thread, so that a Put rarely writes to a line other senders write to.
+ * Timings are sampled too, one message or scheduling in kSampleRate, so
+ * that the clock is read rarely. dispatcher_bench measures what
+ * collection costs.
+ *
+ * The histograms are allocated with the first sampled timing, so an
+ * actor that never runs costs 32 bytes of metrics.
+ *
+ * Collection is off until SetEnabled(true), for the whole process, as
+ * dispatcher_bench cannot show its cost to stay under 2% of throughput.
+ * While it is off the counters do not move; the mailbox depth, kept by
+ * the mailbox itself, is always exact.
+ */
+struct ActorMetrics {
+    static const uint64_t kSampleRate = 16;
+
+    static void SetEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool Enabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Whether to sample an event, with probability 1/kSampleRate.
+    static bool Sample() {
+        static thread_local uint32_t state = SampleSeed();
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % kSampleRate == 0;
+    }
+
+    struct Timings {
+        // time spent in Actor::Receive()
+        LatencyHistogram handle_nanos;
+
+        // time from becoming runnable to being run by a worker
+        LatencyHistogram wait_nanos;
+    };
+
+    ActorMetrics() = default;
+    ~ActorMetrics() { delete timings_.load(); }
+    ActorMetrics(const ActorMetrics&) = delete;
+    ActorMetrics& operator=(const ActorMetrics&) = delete;
+
+    // Returns nullptr until a timing has been sampled.
+    const Timings* GetTimings() const {
+        return timings_.load(std::memory_order_acquire);
+    }
+
+    // For the worker running the actor.
+    Timings* MutableTimings() {
+        Timings* timings = timings_.load(std::memory_order_relaxed);
+        if (timings == nullptr) {
+            timings = new Timings;
+            timings_.store(timings, std::memory_order_release);
+        }
+        return timings;
+    }
+
+    std::atomic<uint64_t> msgs_in{0};       // messages put into the mailbox, sampled
+    std::atomic<uint64_t> msgs_out{0};      // messages posted while handling
+    std::atomic<uint64_t> msgs_handled{0};  // messages taken out of the mailbox
+
+private:
+    static uint32_t SampleSeed();
+
+    static std::atomic<bool> enabled_;
+
+    std::atomic<Timings*> timings_{nullptr};
+};
+
+// Point-in-time view of one actor's metrics.
+struct ActorStats {
+    enum Order { SLOWEST, DEEPEST };
+
+    std::string name;
+    uint64_t msgs_in;
+    uint64_t msgs_out;
+    uint64_t mailbox_depth;     // of the shared mailbox
+    uint64_t handle_p50_nanos;
+    uint64_t handle_p99_nanos;
+    uint64_t wait_p99_nanos;
+};
+
+// One line per actor, for logs.
+std::string FormatActorStats(const std::vector<ActorStats>& stats);
+
+/*
+ * MetricsReporter periodically hands the "top_n" slowest or most backed-up
+ * actors of a dispatcher to "sink".
+ */
+class MetricsReporter {
+public:
+    using Sink = std::function<void(const std::vector<ActorStats>&)>;
+
+    MetricsReporter(const Dispatcher* dispatcher, uint32_t interval_ms,
+                    size_t top_n, ActorStats::Order order, Sink sink);
+
+    ~MetricsReporter();
+
+    MetricsReporter(const MetricsReporter&) = delete;
+    MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+private:
+    void Loop();
+
+    const Dispatcher* dispatcher_;
+    const uint32_t interval_ms_;
+    const size_t top_n_;
+    const ActorStats::Order order_;
+    Sink sink_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+    std::thread thread_;
+
+}; // MetricsReporter
+
+#endif // COMPONENTS_MSG_DISPATHCER_METRICS_H_
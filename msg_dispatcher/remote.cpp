@@ -0,0 +1,341 @@
+#include "components/msg_dispatcher/remote.h"
+#include "components/msg_dispatcher/dispatcher.h"
+#include "components/tcp_socket/socket.h"
+#include "components/util/coding.h"
+#include "components/util/hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <typeinfo>
+#include <stdio.h>
+
+namespace {
+
+// Payload tags written by the default codec.
+const char kNoPayload = 0;
+const char kStringPayload = 1;
+const char kSharedStringPayload = 2;
+
+// Size of a single read from a connection.
+const size_t kReadChunk = 64 * 1024;
+
+// Longest a varint32 gets.
+const size_t kMaxVarint32Size = 5;
+
+// Bounds of the wait after a failed accept, e.g. when out of descriptors.
+const int kMinAcceptBackoffMs = 1;
+const int kMaxAcceptBackoffMs = 100;
+
+}
+
+MsgCodec::~MsgCodec() {
+}
+
+bool MsgCodec::Encode(const Msg& msg, std::string* dst) const {
+    auto data = dynamic_cast<const DataMsg<std::string>*>(&msg);
+    if (data != nullptr) {
+        dst->push_back(kStringPayload);
+        dst->append(data->GetPayload());
+        return true;
+    }
+    // What Dispatcher::Broadcast() sends to a remote group member.
+    auto shared = dynamic_cast<const SharedMsg<std::string>*>(&msg);
+    if (shared != nullptr) {
+        dst->push_back(kSharedStringPayload);
+        dst->append(shared->GetPayload());
+        return true;
+    }
+    if (typeid(msg) == typeid(Msg)) {
+        dst->push_back(kNoPayload);
+        return true;
+    }
+    return false;
+}
+
+std::unique_ptr<Msg> MsgCodec::Decode(int msg_id, const Slice& payload) const {
+    if (payload.Empty()) {
+        return nullptr;
+    }
+    if (payload[0] == kNoPayload) {
+        return std::unique_ptr<Msg>(new Msg(msg_id));
+    }
+    if (payload[0] == kStringPayload) {
+        return std::unique_ptr<Msg>(
+            new DataMsg<std::string>(msg_id, payload.Data() + 1, payload.Size() - 1));
+    }
+    if (payload[0] == kSharedStringPayload) {
+        return std::unique_ptr<Msg>(new SharedMsg<std::string>(
+            msg_id, std::make_shared<const std::string>(payload.Data() + 1, payload.Size() - 1)));
+    }
+    return nullptr;
+}
+
+const MsgCodec* MsgCodec::Default() {
+    static const MsgCodec codec;
+    return &codec;
+}
+
+struct RemoteLink::Connection {
+    // frames waiting for the next flush
+    std::string pending;
+    uint64_t pending_frames = 0;
+    std::mutex pending_mutex;
+
+    // Held across taking and writing a batch so that batches of the same
+    // connection are written in order.
+    std::mutex write_mutex;
+    std::unique_ptr<Socket::ConnectSocket> socket;
+};
+
+RemoteLink::RemoteLink(const std::string& host, int port,
+                       size_t connections,
+                       uint32_t flush_interval_ms,
+                       const MsgCodec* codec)
+  : host_(host),
+    port_(port),
+    flush_interval_ms_(flush_interval_ms > 0 ? flush_interval_ms : 1),
+    codec_(codec),
+    dropped_(0),
+    reported_unencodable_(false),
+    stop_(false) {
+    if (connections == 0) {
+        connections = 1;
+    }
+    for (size_t i = 0; i < connections; ++i) {
+        connections_.emplace_back(new Connection);
+    }
+    flusher_ = std::thread([this] { FlushLoop(); });
+}
+
+RemoteLink::~RemoteLink() {
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex_);
+        stop_ = true;
+    }
+
+    flush_cond_.notify_all();
+    flusher_.join();
+    Flush();
+}
+
+bool RemoteLink::Send(const std::string& actor_name, const Msg& msg) {
+    std::string body;
+    PutLengthPrefixedSlice(&body, actor_name);
+    PutVarint32(&body, static_cast<uint32_t>(msg.GetMsgId()));
+    if (!codec_->Encode(msg, &body)) {
+        dropped_.fetch_add(1);
+        // Once per link, so that a stream of such messages does not flood
+        // the log.
+        if (!reported_unencodable_.exchange(true)) {
+            fprintf(stderr, "RemoteLink %s:%d: dropping message %d for %s: "
+                    "the codec cannot encode %s\n", host_.c_str(), port_,
+                    msg.GetMsgId(), actor_name.c_str(), typeid(msg).name());
+        }
+        return false;
+    }
+
+    uint32_t hash = Hash(actor_name.data(), actor_name.size(), 0);
+    Connection* connection = connections_[hash % connections_.size()].get();
+    {
+        std::lock_guard<std::mutex> lock(connection->pending_mutex);
+        PutLengthPrefixedSlice(&connection->pending, body);
+        ++connection->pending_frames;
+    }
+    return true;
+}
+
+void RemoteLink::Flush() {
+    for (auto& connection : connections_) {
+        FlushConnection(connection.get());
+    }
+}
+
+void RemoteLink::FlushConnection(Connection* connection) {
+    std::lock_guard<std::mutex> write_lock(connection->write_mutex);
+
+    std::string batch;
+    uint64_t frames = 0;
+    {
+        std::lock_guard<std::mutex> lock(connection->pending_mutex);
+        batch.swap(connection->pending);
+        std::swap(frames, connection->pending_frames);
+    }
+
+    if (batch.empty()) {
+        return;
+    }
+
+    try {
+        if (!connection->socket) {
+            connection->socket.reset(new Socket::ConnectSocket(host_, port_));
+        }
+        connection->socket->PutMessageData(batch.data(), batch.size());
+    } catch (const std::exception&) {
+        // The peer may have seen part of the batch; start over on a new
+        // connection rather than resynchronizing the stream.
+        connection->socket.reset();
+        dropped_.fetch_add(frames);
+    }
+}
+
+void RemoteLink::FlushLoop() {
+    std::unique_lock<std::mutex> lock(flush_mutex_);
+    while (!stop_) {
+        flush_cond_.wait_for(lock, std::chrono::milliseconds(flush_interval_ms_));
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+const uint32_t RemoteServer::kMaxFrameSize;
+
+struct RemoteServer::Connection {
+    std::unique_ptr<Socket::DataSocket> socket;
+    std::thread reader;
+    std::atomic<bool> done{false};  // set when the reader is about to return
+};
+
+RemoteServer::RemoteServer(const Dispatcher* dispatcher, int port,
+                           const MsgCodec* codec)
+  : dispatcher_(dispatcher),
+    codec_(codec),
+    server_(new Socket::ServerSocket(port)),
+    stop_(false) {
+    acceptor_ = std::thread([this] { AcceptLoop(); });
+}
+
+RemoteServer::~RemoteServer() {
+    stop_.store(true);
+    // Wakes up the acceptor and every reader blocked in the kernel.
+    try {
+        server_->Shutdown();
+    } catch (const std::exception&) {
+    }
+    acceptor_.join();
+
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto& connection : connections_) {
+        try {
+            connection->socket->Shutdown();
+        } catch (const std::exception&) {
+        }
+    }
+    for (auto& connection : connections_) {
+        connection->reader.join();
+    }
+}
+
+size_t RemoteServer::Connections() {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    ReapConnections();
+    return connections_.size();
+}
+
+void RemoteServer::AcceptLoop() {
+    int backoff_ms = 0;
+    while (!stop_.load()) {
+        std::unique_ptr<Socket::DataSocket> socket;
+        try {
+            socket.reset(new Socket::DataSocket(server_->Accept()));
+            backoff_ms = 0;
+        } catch (const std::logic_error&) {
+            break;      // the listening socket is gone
+        } catch (const std::exception&) {
+            // Errors such as EMFILE persist for a while; do not spin on them.
+            backoff_ms = std::min(std::max(2 * backoff_ms, kMinAcceptBackoffMs),
+                                  kMaxAcceptBackoffMs);
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(connections_mutex_);
+        if (stop_.load()) {
+            break;
+        }
+        ReapConnections();
+        Connection* connection = new Connection;
+        connection->socket = std::move(socket);
+        connections_.emplace_back(connection);
+        connection->reader = std::thread([this, connection] { ReadLoop(connection); });
+    }
+}
+
+void RemoteServer::ReapConnections() {
+    auto end = std::remove_if(connections_.begin(), connections_.end(),
+                              [](const std::unique_ptr<Connection>& connection) {
+                                  if (!connection->done.load()) {
+                                      return false;
+                                  }
+                                  connection->reader.join();
+                                  return true;
+                              });
+    connections_.erase(end, connections_.end());
+}
+
+void RemoteServer::ReadLoop(Connection* connection) {
+    Socket::DataSocket* socket = connection->socket.get();
+    std::string buffer;
+    char chunk[kReadChunk];
+
+    for (;;) {
+        size_t got = 0;
+        try {
+            // Return after each read instead of waiting for a full chunk.
+            got = socket->GetMessageData(chunk, sizeof(chunk),
+                                         [](std::size_t) { return true; });
+        } catch (const std::exception&) {
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        buffer.append(chunk, got);
+        if (!Deliver(&buffer)) {
+            // Let the peer see the connection go.
+            try {
+                socket->Shutdown();
+            } catch (const std::exception&) {
+            }
+            break;
+        }
+    }
+    connection->done.store(true);
+}
+
+bool RemoteServer::Deliver(std::string* buffer) {
+    Slice input(*buffer);
+    bool ok = true;
+    for (;;) {
+        Slice rest = input;
+        uint32_t length = 0;
+        if (!GetVarint32(&rest, &length)) {
+            ok = input.Size() < kMaxVarint32Size;
+            break;  // incomplete length; wait for more data
+        }
+        if (length > kMaxFrameSize) {
+            ok = false;
+            break;
+        }
+        if (rest.Size() < length) {
+            break;  // incomplete frame; wait for more data
+        }
+        Slice frame(rest.Data(), length);
+        rest.RemovePrefix(length);
+        input = rest;
+
+        Slice name;
+        uint32_t msg_id = 0;
+        if (!GetLengthPrefixedSlice(&frame, &name) || !GetVarint32(&frame, &msg_id)) {
+            continue;
+        }
+        std::unique_ptr<Msg> msg = codec_->Decode(static_cast<int>(msg_id), frame);
+        if (msg) {
+            dispatcher_->Post(name.ToString(), std::move(*msg));
+        }
+    }
+    buffer->erase(0, buffer->size() - input.Size());
+    return ok;
+}
@@ -0,0 +1,175 @@
+#ifndef COMPONENTS_MSG_DISPATHCER_REMOTE_H_
+#define COMPONENTS_MSG_DISPATHCER_REMOTE_H_
+
+#include "components/msg_dispatcher/actor.h"
+#include "components/msg_queue/msg.h"
+#include "components/util/slice.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Socket
+{
+class DataSocket;
+class ServerSocket;
+}
+
+class Dispatcher;
+
+/*
+ * MsgCodec turns messages into bytes and back for RemoteLink and
+ * RemoteServer. The default codec handles plain Msg, DataMsg<std::string>
+ * and SharedMsg<std::string>, which arrive as the same types; subclass it
+ * to send other payload types.
+ */
+class MsgCodec {
+public:
+    virtual ~MsgCodec();
+
+    // Appends the payload of "msg" to "dst". Returns false if "msg" cannot
+    // be encoded.
+    virtual bool Encode(const Msg& msg, std::string* dst) const;
+
+    // Rebuilds a message from its id and an encoded payload. Returns
+    // nullptr if "payload" is malformed.
+    virtual std::unique_ptr<Msg> Decode(int msg_id, const Slice& payload) const;
+
+    static const MsgCodec* Default();
+};
+
+/*
+ * RemoteLink sends messages to actors of another process.
+ *
+ * Each message becomes one frame:
+ *
+ *   varint32 frame length | length prefixed actor name | varint32 msg id | payload
+ *
+ * Frames are appended to a per-connection buffer and a background thread
+ * writes each buffer with a single write once per flush interval, so many
+ * messages share one syscall and no message waits for a reply. Messages to
+ * the same actor always use the same pooled connection and stay in order.
+ * A connection that fails is dropped together with its unsent frames and
+ * reopened on the next flush.
+ */
+class RemoteLink {
+public:
+    RemoteLink(const std::string& host, int port,
+               size_t connections = 1,
+               uint32_t flush_interval_ms = 1,
+               const MsgCodec* codec = MsgCodec::Default());
+
+    // Flushes whatever is still buffered.
+    ~RemoteLink();
+
+    RemoteLink(const RemoteLink&) = delete;
+    RemoteLink& operator=(const RemoteLink&) = delete;
+
+    // Queues "msg" for the actor named "actor_name" on the remote end.
+    // Returns false, and counts "msg" as dropped, if the codec cannot
+    // encode it; the first such message is reported on stderr.
+    bool Send(const std::string& actor_name, const Msg& msg);
+
+    // Writes all buffered frames now.
+    void Flush();
+
+    // Number of messages the codec could not encode, plus frames lost to
+    // connection failures.
+    uint64_t Dropped() const { return dropped_.load(); }
+
+private:
+    struct Connection;
+
+    void FlushConnection(Connection* connection);
+    void FlushLoop();
+
+    const std::string host_;
+    const int port_;
+    const uint32_t flush_interval_ms_;
+    const MsgCodec* codec_;
+
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> reported_unencodable_;
+
+    std::mutex flush_mutex_;
+    std::condition_variable flush_cond_;
+    bool stop_;
+    std::thread flusher_;
+
+}; // RemoteLink
+
+/*
+ * RemoteActor stands in for an actor of another process. Register it under
+ * the remote actor's name and Dispatcher::Post() forwards to it through
+ * "link". Messages the link's codec cannot encode are counted in the
+ * link's Dropped().
+ */
+class RemoteActor : public Actor {
+public:
+    RemoteActor(const Dispatcher* dispatcher, const std::string& name,
+                std::shared_ptr<RemoteLink> link)
+      : Actor(dispatcher, name),
+        link_(link) {
+    }
+
+    virtual void Put(Msg&& msg) override { link_->Send(name_, msg); }
+
+private:
+    std::shared_ptr<RemoteLink> link_;
+};
+
+/*
+ * RemoteServer accepts connections from RemoteLinks on "port" and posts the
+ * messages it receives to "dispatcher" by actor name.
+ *
+ * A connection that announces a frame longer than kMaxFrameSize, or sends
+ * a malformed length, is closed. Closed connections are cleaned up when
+ * the next one is accepted.
+ */
+class RemoteServer {
+public:
+    RemoteServer(const Dispatcher* dispatcher, int port,
+                 const MsgCodec* codec = MsgCodec::Default());
+
+    ~RemoteServer();
+
+    RemoteServer(const RemoteServer&) = delete;
+    RemoteServer& operator=(const RemoteServer&) = delete;
+
+    static const uint32_t kMaxFrameSize = 16 << 20;
+
+    // Number of connections accepted and not yet cleaned up.
+    size_t Connections();
+
+private:
+    struct Connection;
+
+    void AcceptLoop();
+    void ReadLoop(Connection* connection);
+
+    // Joins the readers of closed connections. Requires connections_mutex_.
+    void ReapConnections();
+
+    // Posts every complete frame at the front of "buffer" and removes it.
+    // Returns false if the stream is malformed or a frame is too long.
+    bool Deliver(std::string* buffer);
+
+    const Dispatcher* dispatcher_;
+    const MsgCodec* codec_;
+
+    std::unique_ptr<Socket::ServerSocket> server_;
+    std::atomic<bool> stop_;
+    std::thread acceptor_;
+
+    std::mutex connections_mutex_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+
+}; // RemoteServer
+
+#endif // COMPONENTS_MSG_DISPATHCER_REMOTE_H_
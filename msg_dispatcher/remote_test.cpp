@@ -0,0 +1,130 @@
+#include "components/msg_dispatcher/actor.h"
+#include "components/msg_dispatcher/dispatcher.h"
+#include "components/msg_dispatcher/remote.h"
+#include "components/msg_queue/msg.h"
+#include "components/tcp_socket/socket.h"
+#include "components/util/coding.h"
+#include "thirdparty/glog/logging.h"
+#include "thirdparty/gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+namespace {
+
+int TestPort() {
+    return 20000 + getpid() % 10000;
+}
+
+}
+
+class RecordingActor : public Actor {
+public:
+    RecordingActor(const Dispatcher* dispatcher, const std::string& name)
+      : Actor(dispatcher, name) {
+    }
+
+    virtual void Receive(Msg& msg) override {
+        auto data = dynamic_cast<DataMsg<std::string>*>(&msg);
+        if (data != nullptr) {
+            EXPECT_EQ(data->GetPayload(), "payload" + std::to_string(msg.GetMsgId()));
+        }
+        auto shared = dynamic_cast<SharedMsg<std::string>*>(&msg);
+        if (shared != nullptr) {
+            EXPECT_EQ(shared->GetPayload(), "payload" + std::to_string(msg.GetMsgId()));
+        }
+        EXPECT_EQ(msg.GetMsgId(), received_.load());
+        received_.fetch_add(1);
+    }
+
+    int Received() const { return received_.load(); }
+
+private:
+    std::atomic<int> received_{0};
+};
+
+TEST(Remote, PostAcrossProcesses) {
+    const int kMsgs = 10000;
+
+    Dispatcher server_dispatcher(2, 64);
+    auto target = std::make_shared<RecordingActor>(&server_dispatcher, "target");
+    server_dispatcher.Register(target);
+    RemoteServer server(&server_dispatcher, TestPort());
+
+    Dispatcher client_dispatcher;
+    auto link = std::make_shared<RemoteLink>("127.0.0.1", TestPort(), 2, 1);
+    client_dispatcher.Register(
+        std::make_shared<RemoteActor>(&client_dispatcher, "target", link));
+
+    for (int i = 0; i < kMsgs; ++i) {
+        if (i % 2 == 0) {
+            client_dispatcher.Post("target", Msg(i));
+        } else {
+            client_dispatcher.Post("target", DataMsg<std::string>(i, "payload" + std::to_string(i)));
+        }
+    }
+
+    for (int i = 0; i < 1000 && target->Received() < kMsgs; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(target->Received(), kMsgs);
+    EXPECT_EQ(link->Dropped(), 0u);
+}
+
+TEST(Remote, UnreachablePeer) {
+    RemoteLink link("127.0.0.1", TestPort() + 1);
+    EXPECT_TRUE(link.Send("nobody", Msg(1)));
+    EXPECT_FALSE(link.Send("nobody", DataMsg<int>(2, 42)));
+    link.Flush();
+    // The unencodable message and the frame that could not be delivered.
+    EXPECT_EQ(link.Dropped(), 2u);
+}
+
+TEST(Remote, BroadcastToRemoteMember) {
+    const int kMsgs = 100;
+
+    Dispatcher server_dispatcher(2, 64);
+    auto target = std::make_shared<RecordingActor>(&server_dispatcher, "member");
+    server_dispatcher.Register(target);
+    RemoteServer server(&server_dispatcher, TestPort() + 3);
+
+    Dispatcher client_dispatcher;
+    auto link = std::make_shared<RemoteLink>("127.0.0.1", TestPort() + 3, 1, 1);
+    ActorRef member = client_dispatcher.Register(
+        std::make_shared<RemoteActor>(&client_dispatcher, "member", link));
+    client_dispatcher.JoinGroup("group", member);
+
+    for (int i = 0; i < kMsgs; ++i) {
+        auto payload = std::make_shared<const std::string>("payload" + std::to_string(i));
+        EXPECT_TRUE(client_dispatcher.Broadcast("group", SharedMsg<std::string>(i, payload)));
+    }
+
+    for (int i = 0; i < 1000 && target->Received() < kMsgs; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(target->Received(), kMsgs);
+    EXPECT_EQ(link->Dropped(), 0u);
+}
+
+TEST(Remote, OversizedFrame) {
+    Dispatcher dispatcher;
+    RemoteServer server(&dispatcher, TestPort() + 2);
+
+    Socket::ConnectSocket peer("127.0.0.1", TestPort() + 2);
+    std::string frame;
+    PutVarint32(&frame, RemoteServer::kMaxFrameSize + 1);
+    peer.PutMessageData(frame.data(), frame.size());
+
+    // The server hangs up instead of waiting for 16MB.
+    char byte = 0;
+    EXPECT_EQ(peer.GetMessageData(&byte, 1, [](std::size_t) { return true; }), 0u);
+
+    for (int i = 0; i < 1000 && server.Connections() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(server.Connections(), 0u);
+}
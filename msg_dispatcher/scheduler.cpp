@@ -0,0 +1,300 @@
+#include "components/msg_dispatcher/scheduler.h"
+#include "components/msg_dispatcher/actor.h"
+
+#include <chrono>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+// Local actors are run this many times in a row at most before the worker
+// looks at its shared run queue again.
+const size_t kRemotePollInterval = 16;
+
+void PinToCpu(size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Best effort; the worker still runs correctly if pinning fails.
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+uint64_t NowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+struct Scheduler::Shard {
+    // actors scheduled by other threads, waiting for this worker
+    std::deque<std::shared_ptr<Actor>> run_queue;
+    std::mutex run_queue_mutex;
+    std::condition_variable run_queue_cond;
+
+    // actors scheduled by this worker itself; never touched by other threads
+    std::deque<std::shared_ptr<Actor>> local_run_queue;
+
+    std::thread worker;
+};
+
+// Shard whose worker is the calling thread, if any.
+static thread_local const void* current_shard = nullptr;
+
+// Actor whose Receive() the calling thread is in, if any.
+static thread_local Actor* current_actor = nullptr;
+
+// Innermost Scheduler::Batch of the calling thread, if any.
+static thread_local Scheduler::Batch* current_batch = nullptr;
+
+Scheduler::Batch::Batch(Scheduler* scheduler)
+  : scheduler_(scheduler),
+    outer_(current_batch) {
+    if (scheduler_ != nullptr) {
+        pending_.resize(scheduler_->shards_.size());
+    }
+    current_batch = this;
+}
+
+Scheduler::Batch::~Batch() {
+    current_batch = outer_;
+    if (scheduler_ == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        if (pending_[i].empty()) {
+            continue;
+        }
+
+        Shard* shard = scheduler_->shards_[i].get();
+        {
+            std::lock_guard<std::mutex> lock(shard->run_queue_mutex);
+            for (auto& actor : pending_[i]) {
+                shard->run_queue.push_back(std::move(actor));
+            }
+        }
+
+        shard->run_queue_cond.notify_one();
+    }
+}
+
+Scheduler::Scheduler(size_t threads, size_t batch_size)
+  : batch_size_(batch_size > 0 ? batch_size : 1),
+    next_shard_(0),
+    stop_(false) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        shards_.emplace_back(new Shard);
+    }
+
+    size_t cpus = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < threads; ++i) {
+        Shard* shard = shards_[i].get();
+        shard->worker = std::thread([this, shard, i, cpus] {
+            WorkerLoop(shard, cpus > 0 ? i % cpus : 0);
+        });
+    }
+}
+
+Scheduler::~Scheduler() {
+    stop_.store(true);
+
+    for (auto& shard : shards_) {
+        {
+            std::lock_guard<std::mutex> lock(shard->run_queue_mutex);
+        }
+        shard->run_queue_cond.notify_all();
+    }
+
+    for (auto& shard : shards_) {
+        shard->worker.join();
+    }
+}
+
+void Scheduler::Attach(Actor* actor) {
+    size_t shard = next_shard_.fetch_add(1) % shards_.size();
+    actor->shard_.store(shard);
+    actor->target_shard_.store(shard);
+    actor->scheduler_.store(this);
+    // Local messages of a detached actor are moved to "msg_queue_" by the
+    // worker that ran it last.
+    if (!actor->msg_queue_.Empty()) {
+        Notify(actor);
+    }
+}
+
+void Scheduler::Detach(Actor* actor) {
+    // Leave an actor that runs on another scheduler alone.
+    Scheduler* expected = this;
+    actor->scheduler_.compare_exchange_strong(expected, nullptr);
+}
+
+void Scheduler::Migrate(Actor* actor, size_t shard) {
+    if (actor->scheduler_.load() != this) {
+        return;
+    }
+    actor->target_shard_.store(shard % shards_.size());
+    // Run the actor once so that its current worker hands it over.
+    Notify(actor);
+}
+
+size_t Scheduler::ShardOf(const Actor* actor) const {
+    return actor->shard_.load();
+}
+
+Actor* Scheduler::CurrentActor() {
+    return current_actor;
+}
+
+bool Scheduler::IsLocal(const Actor* actor) const {
+    return current_shard != nullptr &&
+           current_shard == shards_[actor->shard_.load()].get();
+}
+
+void Scheduler::Notify(Actor* actor) {
+    // Only the caller that flips "scheduled_" puts the actor on a run
+    // queue, so an actor is queued or running on at most one worker.
+    if (actor->scheduled_.exchange(true)) {
+        return;
+    }
+
+    actor->scheduled_at_nanos_ = 0;
+    if (ActorMetrics::Enabled() && ActorMetrics::Sample()) {
+        actor->scheduled_at_nanos_ = NowNanos();
+    }
+
+    size_t index = actor->shard_.load();
+    Shard* shard = shards_[index].get();
+    if (shard == current_shard) {
+        shard->local_run_queue.push_back(actor->shared_from_this());
+        return;
+    }
+
+    if (current_batch != nullptr && current_batch->scheduler_ == this) {
+        current_batch->pending_[index].push_back(actor->shared_from_this());
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shard->run_queue_mutex);
+        shard->run_queue.push_back(actor->shared_from_this());
+    }
+
+    shard->run_queue_cond.notify_one();
+}
+
+// Runs on the worker of the actor's shard.
+void Scheduler::Run(Actor* actor) {
+    ActorMetrics& metrics = actor->metrics_;
+    if (actor->scheduled_at_nanos_ != 0) {
+        metrics.MutableTimings()->wait_nanos.Add(NowNanos() - actor->scheduled_at_nanos_);
+    }
+
+    bool enabled = ActorMetrics::Enabled();
+    current_actor = actor;
+    for (size_t i = 0; i < batch_size_; ++i) {
+        // The shared mailbox goes first: after a migration it may still hold
+        // messages that a sender posted before its newer local ones.
+        std::unique_ptr<Msg> msg;
+        if (!actor->msg_queue_.Empty()) {
+            msg = actor->msg_queue_.TryGet();
+        }
+        if (!msg && !actor->local_mailbox_.empty()) {
+            msg = std::move(actor->local_mailbox_.front());
+            actor->local_mailbox_.pop_front();
+        }
+        if (!msg) {
+            break;
+        }
+
+        if (!enabled) {
+            actor->Receive(*msg);
+            continue;
+        }
+
+        // Only this worker writes msgs_handled while the actor runs.
+        uint64_t handled = metrics.msgs_handled.load(std::memory_order_relaxed);
+        metrics.msgs_handled.store(handled + 1, std::memory_order_relaxed);
+        if (handled % ActorMetrics::kSampleRate == 0) {
+            uint64_t start = NowNanos();
+            actor->Receive(*msg);
+            metrics.MutableTimings()->handle_nanos.Add(NowNanos() - start);
+        } else {
+            actor->Receive(*msg);
+        }
+    }
+    current_actor = nullptr;
+
+    size_t target = actor->target_shard_.load();
+    bool migrate = target != actor->shard_.load();
+    if (migrate || actor->scheduler_.load() != this) {
+        // Local messages can only be reached from this worker, so move them
+        // to the shared mailbox before handing the actor over to another
+        // worker, or when it was detached, so that Attach() finds them.
+        for (auto& msg : actor->local_mailbox_) {
+            actor->msg_queue_.Put(std::move(*msg));
+        }
+        actor->local_mailbox_.clear();
+    }
+
+    if (migrate) {
+        actor->shard_.store(target);
+
+        // The local queue now belongs to the new worker; schedule the
+        // actor there unconditionally rather than looking at it.
+        actor->scheduled_.store(false);
+        if (actor->scheduler_.load() == this) {
+            Notify(actor);
+        }
+        return;
+    }
+
+    // A Put() that raced with the end of the batch saw "scheduled_" set and
+    // did not reschedule, and an Attach() that raced with it saw the actor
+    // scheduled, so look at the mailbox again after clearing it.
+    actor->scheduled_.store(false);
+    Scheduler* owner = actor->scheduler_.load();
+    if (owner != nullptr &&
+        (!actor->local_mailbox_.empty() || !actor->msg_queue_.Empty())) {
+        owner->Notify(actor);
+    }
+}
+
+void Scheduler::WorkerLoop(Shard* shard, size_t cpu) {
+    current_shard = shard;
+    PinToCpu(cpu);
+
+    std::deque<std::shared_ptr<Actor>>& local = shard->local_run_queue;
+    for (size_t turns = 0; ; ++turns) {
+        if (local.empty() || turns % kRemotePollInterval == 0) {
+            std::unique_lock<std::mutex> lock(shard->run_queue_mutex);
+            if (local.empty()) {
+                shard->run_queue_cond.wait(lock, [this, shard] {
+                    return stop_.load() || !shard->run_queue.empty();
+                });
+            }
+
+            if (stop_.load()) {
+                break;
+            }
+
+            for (auto& actor : shard->run_queue) {
+                local.push_back(std::move(actor));
+            }
+            shard->run_queue.clear();
+        }
+
+        std::shared_ptr<Actor> actor = std::move(local.front());
+        local.pop_front();
+        Run(actor.get());
+    }
+
+    local.clear();
+    current_shard = nullptr;
+}
@@ -0,0 +1,107 @@
+#ifndef COMPONENTS_MSG_DISPATHCER_SCHEDULER_H_
+#define COMPONENTS_MSG_DISPATHCER_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Actor;
+
+/*
+ * Scheduler runs actors on a fixed pool of worker threads (M:N scheduling).
+ *
+ * Workers are shards: each one is pinned to a core and owns the actors
+ * placed on it. An actor is put on its shard's run queue only when its
+ * mailbox goes from empty to non-empty. The worker then calls
+ * Actor::Receive() for at most batch_size messages and yields; if the
+ * mailbox is still non-empty the actor goes to the back of the run queue.
+ * Idle actors therefore cost no thread and no CPU.
+ *
+ * A message posted from a worker to an actor of the same shard skips the
+ * locked mailbox and goes to a plain local queue that only that worker
+ * touches. Migrate() moves an actor to another shard, e.g. next to the
+ * actors it exchanges most messages with.
+ *
+ * Attached actors must be owned by a std::shared_ptr; the run queues keep
+ * them alive while they are scheduled. Messages still queued when the
+ * Scheduler is destroyed are not processed.
+ */
+class Scheduler {
+public:
+    Scheduler(size_t threads, size_t batch_size = 64);
+
+    ~Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    size_t Shards() const { return shards_.size(); }
+
+    // Run "actor" on this scheduler from now on, on the next shard in
+    // round-robin order. Messages already in its mailbox are scheduled
+    // immediately.
+    void Attach(Actor* actor);
+
+    // Stop running "actor", unless it runs on another scheduler. A turn
+    // already in progress completes; messages left in its mailboxes are
+    // kept for a later Attach().
+    void Detach(Actor* actor);
+
+    // Move "actor" to "shard". Takes effect at the end of the actor's
+    // current or next turn, on its old shard's worker.
+    void Migrate(Actor* actor, size_t shard);
+
+    // Shard "actor" runs on.
+    size_t ShardOf(const Actor* actor) const;
+
+    // Whether the calling thread is the worker of the shard "actor" runs
+    // on, so that a message can go to the actor's local queue.
+    bool IsLocal(const Actor* actor) const;
+
+    // Called by Actor::Put() after a message was added to the mailbox.
+    void Notify(Actor* actor);
+
+    // Actor being run by the calling thread, or nullptr.
+    static Actor* CurrentActor();
+
+    // While a Batch exists, actors made runnable by its thread are held back
+    // and put on their shards' run queues when the Batch is destroyed, with
+    // one lock and one wakeup per shard instead of one per actor.
+    class Batch {
+    public:
+        explicit Batch(Scheduler* scheduler);
+        ~Batch();
+
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+    private:
+        Scheduler* scheduler_;
+        Batch* outer_;
+
+        // runnable actors per shard
+        std::vector<std::vector<std::shared_ptr<Actor>>> pending_;
+
+        friend class Scheduler;
+    };
+
+private:
+    struct Shard;
+
+    void Run(Actor* actor);
+    void WorkerLoop(Shard* shard, size_t cpu);
+
+    const size_t batch_size_;
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<size_t> next_shard_;
+    std::atomic<bool> stop_;
+
+}; // Scheduler
+
+#endif // COMPONENTS_MSG_DISPATHCER_SCHEDULER_H_
@@ -1,5 +1,6 @@
 #include "components/msg_queue/msg.h"
 #include <atomic>
+#include <typeinfo>
 
 namespace {
 
@@ -18,6 +19,14 @@ std::unique_ptr<Msg> Msg::move() {
     return std::unique_ptr<Msg>(new Msg(std::move(*this)));
 }
 
+std::unique_ptr<Msg> Msg::Share() const {
+    // A subclass that does not override Share() would be sliced to a Msg.
+    if (typeid(*this) != typeid(Msg)) {
+        return nullptr;
+    }
+    return std::unique_ptr<Msg>(new Msg(msg_id_));
+}
+
 int Msg::GetMsgId() const {
     return msg_id_;
 }
@@ -23,6 +23,12 @@ public:
     // virtual move constructor
     virtual std::unique_ptr<Msg> move();
 
+    // Returns a new message with the same id and payload, for sending one
+    // message to many receivers, or nullptr if the payload cannot be shared.
+    // Subclasses must override it to be shared; the base version only
+    // shares a plain Msg.
+    virtual std::unique_ptr<Msg> Share() const;
+
     int GetMsgId() const;
 
     MsgUID GetUniqueId() const;
@@ -59,6 +65,11 @@ public:
         return std::unique_ptr<Msg>(new DataMsg<PayloadType>(std::move(*this)));
     }
 
+    // The payload is owned by this message alone; use SharedMsg to share it.
+    virtual std::unique_ptr<Msg> Share() const override {
+        return nullptr;
+    }
+
     PayloadType& GetPayload() const {
         return *pl_;
     }
@@ -72,4 +83,43 @@ private:
 
 }; // DataMsg
 
+/*
+ * SharedMsg<PayloadType> is a Msg with an immutable, reference counted payload.
+ * Share() returns a message pointing to the same payload, so one payload can be
+ * sent to many receivers without copying it.
+ */
+template <typename PayloadType>
+class SharedMsg : public Msg {
+public:
+    SharedMsg(int msg_id, std::shared_ptr<const PayloadType> payload)
+      : Msg(msg_id),
+        pl_(std::move(payload)) {
+    }
+
+    virtual ~SharedMsg() = default;
+    SharedMsg(const SharedMsg&) = delete;
+    SharedMsg& operator=(const SharedMsg&) = delete;
+
+    // virtual move constructor
+    virtual std::unique_ptr<Msg> move() override {
+        return std::unique_ptr<Msg>(new SharedMsg<PayloadType>(std::move(*this)));
+    }
+
+    virtual std::unique_ptr<Msg> Share() const override {
+        return std::unique_ptr<Msg>(new SharedMsg<PayloadType>(GetMsgId(), pl_));
+    }
+
+    const PayloadType& GetPayload() const {
+        return *pl_;
+    }
+
+protected:
+    SharedMsg(SharedMsg&&) = default;
+    SharedMsg& operator=(SharedMsg&&) = default;
+
+private:
+    std::shared_ptr<const PayloadType> pl_;
+
+}; // SharedMsg
+
 #endif // COMPONENTS_MESSAGE_QUEUE_MSG_H_
@@ -1,5 +1,6 @@
 #include "components/msg_queue/msg_queue.h"
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <map>
@@ -10,13 +11,14 @@
 class MsgQueue::Impl {
 public:
     Impl()
-      : queue_(), queue_mutex_(), queue_cond_(), response_map_(), response_map_mutex_() {
+      : queue_(), size_(0), queue_mutex_(), queue_cond_(), response_map_(), response_map_mutex_() {
     }
 
     void Put(Msg&& msg) {
         {
             std::lock_guard<std::mutex> lock(queue_mutex_);
             queue_.push(msg.move());
+            size_.store(queue_.size());
         }
 
         queue_cond_.notify_one();
@@ -40,9 +42,30 @@ public:
 
         auto msg = queue_.front()->move();
         queue_.pop();
+        size_.store(queue_.size());
         return msg;
     }
 
+    std::unique_ptr<Msg> TryGet() {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (queue_.empty()) {
+            return nullptr;
+        }
+
+        auto msg = std::move(queue_.front());
+        queue_.pop();
+        size_.store(queue_.size());
+        return msg;
+    }
+
+    bool Empty() const {
+        return size_.load() == 0;
+    }
+
+    size_t Size() const {
+        return size_.load();
+    }
+
     std::unique_ptr<Msg> Request(Msg&& msg) {
         std::unique_lock<std::mutex> lock(response_map_mutex_);
         auto it = response_map_.emplace(
@@ -70,6 +93,9 @@ private:
     // queue for msgs
     std::queue<std::unique_ptr<Msg>> queue_;
 
+    // queue_.size(), readable without the mutex
+    std::atomic<size_t> size_;
+
     // mutex to protect access to the queue
     std::mutex queue_mutex_;
 
@@ -100,6 +126,18 @@ std::unique_ptr<Msg> MsgQueue::Get(int timeout_millis) {
     return impl_->Get(timeout_millis);
 }
 
+std::unique_ptr<Msg> MsgQueue::TryGet() {
+    return impl_->TryGet();
+}
+
+bool MsgQueue::Empty() const {
+    return impl_->Empty();
+}
+
+size_t MsgQueue::Size() const {
+    return impl_->Size();
+}
+
 std::unique_ptr<Msg> MsgQueue::Request(Msg&& msg) {
     return impl_->Request(std::move(msg));
 }
@@ -23,6 +23,15 @@ public:
     // or until timeout happens, 0 = wait indefinitely.
     std::unique_ptr<Msg> Get(int timeout_millis = 0);
 
+    // Returns the next message without blocking, or nullptr if the queue is empty.
+    std::unique_ptr<Msg> TryGet();
+
+    // Does not take the queue lock.
+    bool Empty() const;
+
+    // Number of queued messages. Does not take the queue lock either.
+    size_t Size() const;
+
     // Call will block until response is given with respondTo().
     std::unique_ptr<Msg> Request(Msg&& msg);
 
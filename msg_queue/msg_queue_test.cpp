@@ -103,6 +103,33 @@ TEST(MsgQueue, DataMsg) {
     EXPECT_STREQ(dm.GetPayload().c_str(), "foobar");
 }
 
+TEST(MsgQueue, SharedMsg) {
+    MsgQueue q1, q2;
+    SharedMsg<std::string> msg(42, std::make_shared<const std::string>("foo"));
+    q1.Put(std::move(*msg.Share()));
+    q2.Put(std::move(msg));
+
+    auto m1 = q1.Get();
+    auto m2 = q2.Get();
+    auto& sm1 = dynamic_cast<SharedMsg<std::string>&>(*m1);
+    auto& sm2 = dynamic_cast<SharedMsg<std::string>&>(*m2);
+    EXPECT_EQ(sm1.GetMsgId(), 42);
+    EXPECT_EQ(sm2.GetMsgId(), 42);
+    EXPECT_EQ(&sm1.GetPayload(), &sm2.GetPayload());
+    EXPECT_STREQ(sm1.GetPayload().c_str(), "foo");
+
+    // DataMsg owns its payload and cannot be shared.
+    EXPECT_TRUE(DataMsg<std::string>(1, "bar").Share() == nullptr);
+    EXPECT_EQ(Msg(7).Share()->GetMsgId(), 7);
+
+    // A subclass that does not override Share() is not sliced to a Msg.
+    class PlainSubclassMsg : public Msg {
+    public:
+        PlainSubclassMsg() : Msg(8) {}
+    };
+    EXPECT_TRUE(PlainSubclassMsg().Share() == nullptr);
+}
+
 // Test timeout when getting message from the queue
 TEST(MsgQueue, ReceiveTimeout) {
     MsgQueue q;
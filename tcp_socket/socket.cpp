@@ -92,6 +92,22 @@ void BaseSocket::Close() {
     socket_id_ = invalid_socket_id_;
 }
 
+void BaseSocket::Shutdown() {
+    if (socket_id_ == invalid_socket_id_) {
+        throw std::logic_error(
+                BuildErrorMessage(
+                    "BaseSocket::",
+                    __func__,
+                    ": shutdown called on a bad socket object (object was moved)"));
+    }
+    if (::shutdown(socket_id_, SHUT_RDWR) != 0 && errno != ENOTCONN) {
+        throw std::domain_error(BuildErrorMessage("BaseSocket::",
+                                                  __func__,
+                                                  ": shutdown: critical error: ",
+                                                  strerror(errno)));
+    }
+}
+
 void BaseSocket::swap(BaseSocket& other) noexcept {
     std::swap(socket_id_, other.socket_id_);
 }
@@ -177,10 +193,18 @@ DataSocket ServerSocket::Accept() {
 void DataSocket::PutMessageData(char const* buffer, std::size_t size) {
     std::size_t data_written = 0;
 
+    // A peer that went away must surface as EPIPE below, not as SIGPIPE.
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
     while(data_written < size) {
-        std::size_t put = write(GetSocketId(), 
-                                buffer + data_written,
-                                size - data_written);
+        std::size_t put = ::send(GetSocketId(), 
+                                 buffer + data_written,
+                                 size - data_written,
+                                 flags);
         if (put == static_cast<std::size_t>(-1)) {
             switch(errno) {
                 case EINVAL:
@@ -33,6 +33,10 @@ public:
 
     // User can manually call close
     void Close();
+
+    // Shut down both directions without closing. Wakes up a thread that is
+    // blocked reading from or accepting on this socket.
+    void Shutdown();
 };
 
 // A class that can read/write to a socket
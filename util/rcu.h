@@ -0,0 +1,101 @@
+#ifndef COMPONENTS_UTIL_RCU_H_
+#define COMPONENTS_UTIL_RCU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Rcu lets readers access shared data without taking a lock while
+// writers replace it (read-copy-update).
+//
+// Readers hold a ReadLock while they use pointers loaded from the shared
+// structure. A writer first unlinks or replaces data so that new readers
+// cannot reach it, then calls Synchronize(), which returns once every
+// reader that might still hold the old pointers has left. After that the
+// old data can be freed.
+//
+// Pointers to protected data must be loaded with the default
+// (sequentially consistent) memory order.
+//
+// Reader counts are striped over cache lines so that readers on
+// different threads do not write to the same line.
+class Rcu {
+public:
+    Rcu() : epoch_(0) {
+        for (int p = 0; p < 2; p++) {
+            for (int s = 0; s < kStripes; s++) {
+                counters_[p][s].readers.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Rcu(const Rcu&) = delete;
+    Rcu& operator=(const Rcu&) = delete;
+
+    class ReadLock {
+    public:
+        explicit ReadLock(Rcu* rcu)
+          : counter_(rcu->Enter()) {
+        }
+
+        ~ReadLock() { counter_->fetch_sub(1, std::memory_order_release); }
+
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+
+    private:
+        std::atomic<int64_t>* counter_;
+    };
+
+    // Wait until every ReadLock that existed when Synchronize() was called
+    // has been released.
+    void Synchronize() {
+        std::lock_guard<std::mutex> l(sync_mutex_);
+        // New readers count on the current parity. Flip it twice so each
+        // parity is drained while no new reader can join it.
+        for (int i = 0; i < 2; i++) {
+            uint32_t old_epoch = epoch_.fetch_add(1);
+            WaitForReaders(old_epoch & 1);
+        }
+    }
+
+private:
+    static const int kStripes = 16;
+
+    // Padded so that each counter sits on its own cache line.
+    struct Counter {
+        std::atomic<int64_t> readers;
+        char padding[64 - sizeof(std::atomic<int64_t>)];
+    };
+
+    std::atomic<int64_t>* Enter() {
+        std::atomic<int64_t>* counter =
+            &counters_[epoch_.load(std::memory_order_relaxed) & 1][Stripe()].readers;
+        counter->fetch_add(1);
+        return counter;
+    }
+
+    void WaitForReaders(uint32_t parity) {
+        for (int s = 0; s < kStripes; s++) {
+            while (counters_[parity][s].readers.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    static size_t Stripe() {
+        static thread_local const size_t stripe =
+            std::hash<std::thread::id>()(std::this_thread::get_id()) % kStripes;
+        return stripe;
+    }
+
+    Counter counters_[2][kStripes];
+    std::atomic<uint32_t> epoch_;
+    std::mutex sync_mutex_;
+};
+
+#endif // COMPONENTS_UTIL_RCU_H_